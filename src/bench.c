@@ -0,0 +1,408 @@
+#include "bench.h"
+#include "main.h"
+#include "db/layout.h"
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// loads a fresh database with the inserts, then times point lookups, short range scans and full scans over it
+int
+main(int argc, char** argv) {
+    static struct option long_options[] = {
+        {"rows", required_argument, NULL, 'r'},
+        {"ops", required_argument, NULL, 'o'},
+        {"distribution", required_argument, NULL, 'd'},
+        {"cache-pages", required_argument, NULL, 'c'},
+        {"mmap", no_argument, NULL, 'm'},
+        {"direct", no_argument, NULL, 'D'},
+        {"no-wal", no_argument, NULL, 'n'},
+        {"scan-length", required_argument, NULL, 'l'},
+        {"full-scans", required_argument, NULL, 's'},
+        {NULL, 0, NULL, 0},
+    };
+
+    DbOptions options = {0};
+    uint32_t num_rows = BENCH_DEFAULT_ROWS;
+    uint64_t num_ops = 0;
+    uint32_t scan_length = BENCH_DEFAULT_SCAN_LENGTH;
+    uint32_t num_full_scans = BENCH_DEFAULT_FULL_SCANS;
+    KeyDistribution distribution = KEYS_RANDOM;
+    const char* distribution_name = "random";
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "r:o:d:c:mDnl:s:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'r':
+                num_rows = atoi(optarg);
+                break;
+            case 'o':
+                num_ops = atoll(optarg);
+                break;
+            case 'd':
+                distribution_name = optarg;
+
+                if (strcmp(optarg, "sequential") == 0) {
+                    distribution = KEYS_SEQUENTIAL;
+                } else if (strcmp(optarg, "random") == 0) {
+                    distribution = KEYS_RANDOM;
+                } else if (strcmp(optarg, "zipf") == 0) {
+                    distribution = KEYS_ZIPF;
+                } else {
+                    printf("unknown distribution: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+
+                break;
+            case 'c':
+                options.cache_frames = atoi(optarg);
+                break;
+            case 'm':
+                options.pager_mode = PAGER_MMAP;
+                break;
+            case 'D':
+                options.pager_mode = PAGER_DIRECT;
+                break;
+            case 'n':
+                options.disable_wal = true;
+                break;
+            case 'l':
+                scan_length = atoi(optarg);
+                break;
+            case 's':
+                num_full_scans = atoi(optarg);
+                break;
+            default:
+                printf("usage: %s [--rows N] [--ops N] [--distribution sequential|random|zipf] [--cache-pages N] "
+                       "[--mmap | --direct] [--no-wal] [--scan-length N] [--full-scans N] "
+                       "<database-storage-filename>\n",
+                       argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (optind >= argc || num_rows == 0 || scan_length == 0 || num_full_scans == 0) {
+        printf("must supply a database filename, rows, scan length and full scans can't be 0\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // the database is made from scratch, whatever the file held is overwritten
+    char* filename = argv[optind];
+    char wal_filename[PATH_MAX];
+
+    snprintf(wal_filename, sizeof(wal_filename), "%s-wal", filename);
+    unlink(filename);
+    unlink(wal_filename);
+
+    if (num_ops == 0) {
+        num_ops = num_rows;
+    }
+
+    KeyGenerator generator;
+    BenchResult result;
+
+    key_generator_init(&generator, distribution, num_rows);
+
+    Table* table = db_open(filename, &options);
+
+    printf("%-12s %-12s %10s %12s %10s %10s %10s %10s %10s\n", "workload", "keys", "ops", "ops/s", "p50 us", "p99 us",
+           "p999 us", "reads/op", "writes/op");
+
+    bench_insert(table, &generator, &result);
+    bench_report(&result, distribution == KEYS_ZIPF ? "random" : distribution_name);
+    bench_point_lookup(table, &generator, num_ops, &result);
+    bench_report(&result, distribution_name);
+    bench_range_scan(table, &generator, num_ops / scan_length > 0 ? num_ops / scan_length : 1, scan_length, &result);
+    bench_report(&result, distribution_name);
+    bench_full_scan(table, num_full_scans, &result);
+    bench_report(&result, "sequential");
+
+    db_close(table);
+    free(generator.order);
+
+    return EXIT_SUCCESS;
+}
+
+uint64_t
+bench_now_ns() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// xorshift64*, plenty for picking keys and much cheaper than the operations it feeds
+uint64_t
+bench_random(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+double
+bench_zeta(uint64_t num_items, double theta) {
+    double sum = 0;
+
+    for (uint64_t i = 1; i <= num_items; i++) {
+        sum += 1 / pow((double) i, theta);
+    }
+
+    return sum;
+}
+
+void
+zipf_init(Zipf* zipf, uint64_t num_items, double theta) {
+    zipf->num_items = num_items;
+    zipf->theta = theta;
+    zipf->alpha = 1 / (1 - theta);
+    zipf->zetan = bench_zeta(num_items, theta);
+    zipf->eta = (1 - pow(2.0 / num_items, 1 - theta)) / (1 - bench_zeta(2, theta) / zipf->zetan);
+}
+
+uint64_t
+zipf_next(Zipf* zipf, uint64_t* state) {
+    double u = (bench_random(state) >> 11) * (1.0 / (1ULL << 53));
+    double uz = u * zipf->zetan;
+
+    if (uz < 1) {
+        return 0;
+    }
+
+    if (uz < 1 + pow(0.5, zipf->theta)) {
+        return 1;
+    }
+
+    uint64_t rank = zipf->num_items * pow(zipf->eta * u - zipf->eta + 1, zipf->alpha);
+
+    return rank < zipf->num_items ? rank : zipf->num_items - 1;
+}
+
+// the keys are 0 to num_rows - 1. The popular Zipfian ranks are spread over the key space through a random
+// permutation, so they don't all land in the same leaves
+void
+key_generator_init(KeyGenerator* generator, KeyDistribution distribution, uint32_t num_rows) {
+    generator->distribution = distribution;
+    generator->num_rows = num_rows;
+    generator->state = 0x9E3779B97F4A7C15ULL;
+    generator->order = NULL;
+
+    if (distribution == KEYS_SEQUENTIAL) {
+        return;
+    }
+
+    generator->order = malloc(num_rows * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < num_rows; i++) {
+        generator->order[i] = i;
+    }
+
+    // Fisher-Yates
+    for (uint32_t i = num_rows - 1; i > 0; i--) {
+        uint32_t j = bench_random(&(generator->state)) % (i + 1);
+        uint32_t key = generator->order[i];
+
+        generator->order[i] = generator->order[j];
+        generator->order[j] = key;
+    }
+
+    if (distribution == KEYS_ZIPF) {
+        zipf_init(&(generator->zipf), num_rows, BENCH_ZIPF_THETA);
+    }
+}
+
+// the key of the i-th insert, every key is inserted once
+uint32_t
+key_generator_insert_key(KeyGenerator* generator, uint32_t i) {
+    return generator->distribution == KEYS_SEQUENTIAL ? i : generator->order[i];
+}
+
+// the key the i-th read operation goes to
+uint32_t
+key_generator_next(KeyGenerator* generator, uint64_t i) {
+    switch (generator->distribution) {
+        case KEYS_SEQUENTIAL:
+            return i % generator->num_rows;
+        case KEYS_RANDOM:
+            return bench_random(&(generator->state)) % generator->num_rows;
+        case KEYS_ZIPF:
+            return generator->order[zipf_next(&(generator->zipf), &(generator->state))];
+    }
+
+    return 0;
+}
+
+void
+bench_begin(BenchResult* result, Table* table, const char* name, uint64_t num_ops) {
+    result->name = name;
+    result->num_ops = num_ops;
+    result->latencies = malloc(num_ops * sizeof(uint64_t));
+    result->pages_read = table->pager->pages_read;
+    result->pages_written = table->pager->pages_written;
+}
+
+void
+bench_end(BenchResult* result, Table* table, uint64_t started_ns) {
+    result->seconds = (bench_now_ns() - started_ns) / 1e9;
+    result->pages_read = table->pager->pages_read - result->pages_read;
+    result->pages_written = table->pager->pages_written - result->pages_written;
+}
+
+int
+compare_latency(const void* a, const void* b) {
+    uint64_t left = *((const uint64_t*) a);
+    uint64_t right = *((const uint64_t*) b);
+
+    return left < right ? -1 : left > right;
+}
+
+// prints a line of the report and frees the latencies
+void
+bench_report(BenchResult* result, const char* distribution) {
+    uint64_t* latencies = result->latencies;
+    uint64_t last = result->num_ops - 1;
+
+    qsort(latencies, result->num_ops, sizeof(uint64_t), compare_latency);
+
+    printf("%-12s %-12s %10lu %12.0f %10.2f %10.2f %10.2f %10.3f %10.3f\n", result->name, distribution,
+           result->num_ops, result->num_ops / result->seconds, latencies[last * 50 / 100] / 1e3,
+           latencies[last * 99 / 100] / 1e3, latencies[last * 999 / 1000] / 1e3,
+           (double) result->pages_read / result->num_ops, (double) result->pages_written / result->num_ops);
+
+    free(latencies);
+}
+
+// inserts every row through the statement path. The pages left dirty are written back at the end, they count in
+// the pages written but not in the latencies
+void
+bench_insert(Table* table, KeyGenerator* generator, BenchResult* result) {
+    Statement statement;
+
+    statement.type = STMT_INSERT;
+    bench_begin(result, table, "insert", generator->num_rows);
+
+    uint64_t started_ns = bench_now_ns();
+
+    for (uint32_t i = 0; i < generator->num_rows; i++) {
+        Row* row = &(statement.row);
+
+        row->id = key_generator_insert_key(generator, i);
+        snprintf(row->name, sizeof(row->name), "user%u", row->id);
+        snprintf(row->email, sizeof(row->email), "user%u@example.com", row->id);
+
+        uint64_t op_ns = bench_now_ns();
+
+        if (exec_stmt_insert(&statement, table) != EXEC_RES_SUCCESS) {
+            printf("insert of key %d failed\n", row->id);
+            exit(EXIT_FAILURE);
+        }
+
+        result->latencies[i] = bench_now_ns() - op_ns;
+    }
+
+    if (table->pager->wal != NULL) {
+        pager_checkpoint(table->pager);
+    } else {
+        pager_flush_dirty(table->pager);
+    }
+
+    bench_end(result, table, started_ns);
+}
+
+// descends to the leaf of every key the way a point select does, without a snapshot. The cursors are on the stack, so
+// the loop allocates nothing
+void
+bench_point_lookup(Table* table, KeyGenerator* generator, uint64_t num_ops, BenchResult* result) {
+    bench_begin(result, table, "lookup", num_ops);
+
+    uint64_t started_ns = bench_now_ns();
+
+    for (uint64_t i = 0; i < num_ops; i++) {
+        uint32_t key = key_generator_next(generator, i);
+        uint64_t op_ns = bench_now_ns();
+        Cursor cursor;
+
+        cursor_find(&cursor, table, key, LATCH_SHARED);
+
+        bool found = cursor.cell_num < *leaf_node_num_cells(cursor.node) &&
+                     *leaf_node_key(cursor.node, cursor.cell_num) == key;
+
+        cursor_unlatch(&cursor);
+        result->latencies[i] = bench_now_ns() - op_ns;
+
+        if (!found) {
+            printf("key %d not found\n", key);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    bench_end(result, table, started_ns);
+}
+
+// reads `length` rows from every key, along the leaf chain
+void
+bench_range_scan(Table* table, KeyGenerator* generator, uint64_t num_ops, uint32_t length, BenchResult* result) {
+    bench_begin(result, table, "range-scan", num_ops);
+
+    uint64_t started_ns = bench_now_ns();
+    uint64_t checksum = 0;
+
+    for (uint64_t i = 0; i < num_ops; i++) {
+        uint32_t key = key_generator_next(generator, i);
+        uint64_t op_ns = bench_now_ns();
+        Cursor cursor;
+
+        cursor_seek(&cursor, table, key);
+
+        for (uint32_t j = 0; j < length && !(cursor.end_of_table); j++) {
+            checksum += row_payload_size(cursor_value(&cursor));
+            cursor_advance(&cursor);
+        }
+
+        cursor_unlatch(&cursor);
+        result->latencies[i] = bench_now_ns() - op_ns;
+    }
+
+    bench_end(result, table, started_ns);
+
+    // NOTE: keeps the compiler from dropping the reads of the rows
+    if (checksum == 0) {
+        printf("range scans read nothing\n");
+    }
+}
+
+// every operation reads the whole table
+void
+bench_full_scan(Table* table, uint32_t num_scans, BenchResult* result) {
+    bench_begin(result, table, "full-scan", num_scans);
+
+    uint64_t started_ns = bench_now_ns();
+    uint64_t checksum = 0;
+
+    for (uint32_t i = 0; i < num_scans; i++) {
+        uint64_t op_ns = bench_now_ns();
+        Cursor* cursor = table_start(table);
+
+        while (!(cursor->end_of_table)) {
+            checksum += row_payload_size(cursor_value(cursor));
+            cursor_advance(cursor);
+        }
+
+        cursor_close(cursor);
+        result->latencies[i] = bench_now_ns() - op_ns;
+    }
+
+    bench_end(result, table, started_ns);
+
+    if (checksum == 0) {
+        printf("full scans read nothing\n");
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "db/layout.h"
+#include <stdint.h>
+
+#define BENCH_DEFAULT_ROWS 100000
+#define BENCH_DEFAULT_SCAN_LENGTH 100
+#define BENCH_DEFAULT_FULL_SCANS 3
+// skew of the Zipfian keys, the value YCSB uses: a few keys take most of the operations
+#define BENCH_ZIPF_THETA 0.99
+
+typedef enum {
+    KEYS_SEQUENTIAL,
+    KEYS_RANDOM,
+    KEYS_ZIPF,  // inserts can't repeat keys, they take the random order
+} KeyDistribution;
+
+// Zipfian ranks out of num_items, rank 0 being the most popular, drawn the way YCSB does (Gray et al., "Quickly
+// generating billion-record synthetic databases")
+typedef struct {
+    uint64_t num_items;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+} Zipf;
+
+typedef struct {
+    KeyDistribution distribution;
+    uint32_t num_rows;
+    uint64_t state;  // xorshift64* state
+    uint32_t *order;  // KEYS_RANDOM and KEYS_ZIPF, a permutation of the keys
+    Zipf zipf;
+} KeyGenerator;
+
+// what a workload measured, latencies are in nanoseconds, one per operation
+typedef struct {
+    const char *name;
+    uint64_t num_ops;
+    uint64_t *latencies;
+    double seconds;
+    uint64_t pages_read;
+    uint64_t pages_written;
+} BenchResult;
+
+uint64_t bench_now_ns();
+uint64_t bench_random(uint64_t *state);
+double bench_zeta(uint64_t num_items, double theta);
+void zipf_init(Zipf *zipf, uint64_t num_items, double theta);
+uint64_t zipf_next(Zipf *zipf, uint64_t *state);
+void key_generator_init(KeyGenerator *generator, KeyDistribution distribution, uint32_t num_rows);
+uint32_t key_generator_insert_key(KeyGenerator *generator, uint32_t i);
+uint32_t key_generator_next(KeyGenerator *generator, uint64_t i);
+void bench_begin(BenchResult *result, Table *table, const char *name, uint64_t num_ops);
+void bench_end(BenchResult *result, Table *table, uint64_t started_ns);
+int compare_latency(const void *a, const void *b);
+void bench_report(BenchResult *result, const char *distribution);
+void bench_insert(Table *table, KeyGenerator *generator, BenchResult *result);
+void bench_point_lookup(Table *table, KeyGenerator *generator, uint64_t num_ops, BenchResult *result);
+void bench_range_scan(Table *table, KeyGenerator *generator, uint64_t num_ops, uint32_t length, BenchResult *result);
+void bench_full_scan(Table *table, uint32_t num_scans, BenchResult *result);
+
+#endif
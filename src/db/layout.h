@@ -1,6 +1,7 @@
 #ifndef DB_LAYOUT_H
 #define DB_LAYOUT_H
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -10,7 +11,60 @@
 
 #define NAME_SIZE 32
 #define EMAIL_SIZE 255
-#define TABLE_MAX_PAGES 100
+#define PAGER_DEFAULT_FRAMES 1024
+// NOTE: a transaction keeps every page it changes pinned, a split rippling up to the root changes two pages per level
+#define PAGER_MIN_FRAMES 32
+// dirty pages that trigger an incremental flush when no DbOptions.flush_threshold is given
+#define PAGER_DEFAULT_FLUSH_THRESHOLD 256
+#define WAL_DEFAULT_COMMIT_WINDOW_MS 10
+#define WAL_DEFAULT_CHECKPOINT_BYTES (16 * 1024 * 1024)
+#define WAL_MAGIC 0x4c415744  // "DWAL"
+#define WAL_VERSION 1
+// unchanged bytes shorter than this are logged along with the delta around them, cheaper than a new record header
+#define WAL_DELTA_MERGE_GAP 16
+#define INVALID_PAGE_NUM UINT32_MAX
+#define INVALID_FRAME UINT32_MAX
+#define BULK_LOAD_DEFAULT_FILL_PERCENT 90
+// pages built between two commits of a bulk load, the pages of a transaction stay pinned so it has to fit the cache
+#define BULK_LOAD_TXN_PAGES 16
+// rows sorted in memory at once when the input of a bulk load isn't sorted, each sorted run is spilled to a temporary
+// file and the runs are merged while loading
+#define BULK_LOAD_RUN_ROWS (64 * 1024)
+#define BULK_LOAD_MERGE_ROWS 256
+// an export writes its output in chunks of this size, a binary export keeps one buffer per column
+#define EXPORT_BUFFER_SIZE (1024 * 1024)
+#define EXPORT_MAGIC 0x4c4f4344  // "DCOL"
+#define EXPORT_VERSION 1
+// the search over the keys of an internal node halves the range until it fits this many keys, then counts the keys
+// below the searched one with vector compares
+#define INTERNAL_NODE_SEARCH_WINDOW 32
+// an internal node holds hundreds of children, so even 2^32 keys don't get anywhere close to this height
+#define BTREE_MAX_HEIGHT 16
+// the mmap pager grows the file and the mapping in extents and reserves the address space up front, so the page
+// pointers it hands out stay valid while the database grows
+#define PAGER_MMAP_EXTENT (16 * 1024 * 1024)
+#define PAGER_MMAP_RESERVE (64ULL * 1024 * 1024 * 1024)
+#define PAGER_MMAP_EXTENT_PAGES (PAGER_MMAP_EXTENT / PAGE_SIZE)
+#define PAGER_VERSION_BUCKETS 1024
+// the buffer pool frames are mapped in whole huge pages of this size
+#define PAGER_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+// 2048 bits and 4 probes: false positives stay under 1% up to ~200 keys, more than a leaf of rows with names and
+// emails of a usual length holds, and reach ~5% for a full leaf of LEAF_NODE_MAX_CELLS (339) of the shortest rows
+#define BLOOM_FILTER_BITS 2048
+#define BLOOM_FILTER_HASHES 4
+// filters are allocated in extents of pages, the directory covers as many pages as the mmap reservation
+#define BLOOM_EXTENT_FILTERS 4096
+#define BLOOM_MAX_EXTENTS (PAGER_MMAP_RESERVE / (PAGE_SIZE * BLOOM_EXTENT_FILTERS))
+// latencies are bucketed the HDR histogram way: below LATENCY_SUB_BUCKETS ns every value has a bucket, above it every
+// power of two is split into LATENCY_SUB_BUCKETS buckets, so a bucket is never wider than ~3% of the values it holds
+#define LATENCY_SUB_BUCKET_BITS 5
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS)
+// one index per indexable column at most
+#define INDEX_MAX 2
+#define CATALOG_MAGIC 0x54414344  // "DCAT"
+// pages an index build changes between two commits, the pages of a transaction stay pinned so it has to fit the cache
+#define INDEX_BUILD_TXN_PAGES 16
 
 typedef struct {
     uint32_t id;
@@ -18,87 +72,379 @@ typedef struct {
     char email[EMAIL_SIZE + 1];  // +1 for the '\0' char
 } Row;
 
-const uint32_t SCHEMA_ID_SIZE = attr_size_identifier(Row, id);
-const uint32_t SCHEMA_NAME_SIZE = attr_size_identifier(Row, name);
-const uint32_t SCHEMA_EMAIL_SIZE = attr_size_identifier(Row, email);
-const uint32_t SCHEMA_ID_OFFSET = 0;
-const uint32_t SCHEMA_NAME_OFFSET = SCHEMA_ID_OFFSET + SCHEMA_ID_SIZE;
-const uint32_t SCHEMA_EMAIL_OFFSET = SCHEMA_NAME_OFFSET + SCHEMA_NAME_SIZE;
-const uint32_t ROW_SIZE = SCHEMA_ID_SIZE + SCHEMA_NAME_SIZE + SCHEMA_EMAIL_SIZE;
-const uint32_t PAGE_SIZE = 4096;
+static const uint32_t SCHEMA_ID_SIZE = attr_size_identifier(Row, id);
+static const uint32_t SCHEMA_NAME_SIZE = attr_size_identifier(Row, name);
+static const uint32_t SCHEMA_EMAIL_SIZE = attr_size_identifier(Row, email);
+// a stored row is [id][name length][name][email length][email], the strings are neither padded nor '\0' terminated
+static const uint32_t SCHEMA_LENGTH_PREFIX_SIZE = sizeof(uint8_t);
+static const uint32_t ROW_MIN_SIZE = SCHEMA_ID_SIZE + 2 * SCHEMA_LENGTH_PREFIX_SIZE;
+static const uint32_t ROW_MAX_SIZE = ROW_MIN_SIZE + NAME_SIZE + EMAIL_SIZE;
+static const uint32_t PAGE_SIZE = 4096;
 
 // common node header layout
 // NOTE: the type just need an 1 bit for the representation until we've only 2 node types, but it's represented inside
 // an entirely byte to make more easely the implementation
-const uint32_t NODE_TYPE_SIZE = sizeof(uint8_t);
-const uint32_t NODE_TYPE_OFFSET = 0;
+static const uint32_t NODE_TYPE_SIZE = sizeof(uint8_t);
+static const uint32_t NODE_TYPE_OFFSET = 0;
 // NOTE: the is root flag just need an 1 bit for the representation until we've only 2 node types, but it's represented
 // inside an entirely byte to make more easely the implementation
-const uint32_t IS_ROOT_SIZE = sizeof(uint8_t);
-const uint32_t IS_ROOT_OFFSET = NODE_TYPE_SIZE;
-const uint32_t PARENT_POINTER_SIZE = sizeof(uint32_t);
-const uint32_t PARENT_POINTER_OFFSET = IS_ROOT_SIZE + IS_ROOT_OFFSET;
-const uint8_t COMMON_NODE_HEADER_SIZE = IS_ROOT_SIZE + NODE_TYPE_SIZE + PARENT_POINTER_SIZE;
+static const uint32_t IS_ROOT_SIZE = sizeof(uint8_t);
+static const uint32_t IS_ROOT_OFFSET = NODE_TYPE_SIZE;
+// NOTE: the parent pointer isn't maintained, a split finds its ancestors in the path recorded by the descent that led to
+// it, so moving children between internal nodes doesn't have to rewrite every one of them
+static const uint32_t PARENT_POINTER_SIZE = sizeof(uint32_t);
+static const uint32_t PARENT_POINTER_OFFSET = IS_ROOT_SIZE + IS_ROOT_OFFSET;
+// the root of the table has no parent, the field holds the page number of the catalog instead, 0 when there's none
+static const uint32_t ROOT_NODE_CATALOG_OFFSET = PARENT_POINTER_OFFSET;
+static const uint8_t COMMON_NODE_HEADER_SIZE = IS_ROOT_SIZE + NODE_TYPE_SIZE + PARENT_POINTER_SIZE;
 
 // leaf node header layout
-const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
-const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE;
-
-// leaf node body layout
-const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
-const uint32_t LEAF_NODE_KEY_OFFSET = 0;
-const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
-const uint32_t LEAF_NODE_VALUE_OFFSET = LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
-const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
-const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
-
-const uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) / 2;  // +1 'cause new node
-const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT =
-    (LEAF_NODE_MAX_CELLS + 1) - LEAF_NODE_RIGHT_SPLIT_COUNT;  // +1 'cause new node
+static const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
+static const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
+// leaves are chained left to right, so a scan goes from one leaf to the next without descending the tree again
+static const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
+static const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET = LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
+// start of the payload region, payloads are allocated from the end of the page downwards
+static const uint32_t LEAF_NODE_CONTENT_START_SIZE = sizeof(uint16_t);
+static const uint32_t LEAF_NODE_CONTENT_START_OFFSET = LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+// bytes of payloads no cell points to anymore, they're given back by compacting the payload region
+static const uint32_t LEAF_NODE_FRAGMENTED_SIZE = sizeof(uint16_t);
+static const uint32_t LEAF_NODE_FRAGMENTED_OFFSET = LEAF_NODE_CONTENT_START_OFFSET + LEAF_NODE_CONTENT_START_SIZE;
+static const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE +
+                                              LEAF_NODE_NEXT_LEAF_SIZE + LEAF_NODE_CONTENT_START_SIZE +
+                                              LEAF_NODE_FRAGMENTED_SIZE;
+
+// leaf node body layout: [header][keys][slots][free space][payloads]
+// the keys are kept contiguous right after the header so a search only reads the key array, the slot of a cell holds
+// the page offset of its payload, so inserting a cell shifts 4-byte keys and 2-byte slots but never a payload
+static const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
+static const uint32_t LEAF_NODE_SLOT_SIZE = sizeof(uint16_t);
+// payloads have the size of the row they hold, so how many cells fit depends on the rows, a leaf splits once the
+// next cell doesn't fit anymore and the split balances bytes rather than cells
+static const uint32_t LEAF_NODE_CELL_OVERHEAD = LEAF_NODE_KEY_SIZE + LEAF_NODE_SLOT_SIZE;
+static const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
+static const uint32_t LEAF_NODE_MIN_CELLS = LEAF_NODE_SPACE_FOR_CELLS / (LEAF_NODE_CELL_OVERHEAD + ROW_MAX_SIZE);
+static const uint32_t LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / (LEAF_NODE_CELL_OVERHEAD + ROW_MIN_SIZE);
 
 // internal node header format
-const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
-const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
-const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
-const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET = INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
-const uint32_t INTERNAL_NODE_HEADER_SIZE =
+static const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
+static const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
+static const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
+static const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET = INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
+static const uint32_t INTERNAL_NODE_HEADER_SIZE =
     COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE + INTERNAL_NODE_RIGHT_CHILD_SIZE;
 
-// internal node body layout
-const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
-const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
-const uint32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
+// internal node body layout: [header][keys][children][counts]
+static const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
+static const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
+// rows under every child, the right child included, so a position or a rank is found along a single root-to-leaf path
+static const uint32_t INTERNAL_NODE_COUNT_SIZE = sizeof(uint32_t);
+static const uint32_t INTERNAL_NODE_CELL_SIZE =
+    INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE + INTERNAL_NODE_COUNT_SIZE;
+// the keys and the children live in two separate arrays, the key array starts 16-byte aligned so the search compares
+// whole vectors of keys. The right child stays in the header
+static const uint32_t INTERNAL_NODE_KEYS_OFFSET = (INTERNAL_NODE_HEADER_SIZE + 15) & ~15;
+static const uint32_t INTERNAL_NODE_SPACE_FOR_CELLS = PAGE_SIZE - INTERNAL_NODE_KEYS_OFFSET;
+static const uint32_t INTERNAL_NODE_MAX_KEYS =
+    (INTERNAL_NODE_SPACE_FOR_CELLS - INTERNAL_NODE_COUNT_SIZE) / INTERNAL_NODE_CELL_SIZE;
+static const uint32_t INTERNAL_NODE_CHILDREN_OFFSET =
+    INTERNAL_NODE_KEYS_OFFSET + INTERNAL_NODE_MAX_KEYS * INTERNAL_NODE_KEY_SIZE;
+static const uint32_t INTERNAL_NODE_COUNTS_OFFSET =
+    INTERNAL_NODE_CHILDREN_OFFSET + INTERNAL_NODE_MAX_KEYS * INTERNAL_NODE_CHILD_SIZE;
+
+// index node header layout
+static const uint32_t INDEX_NODE_NUM_CELLS_SIZE = sizeof(uint16_t);
+static const uint32_t INDEX_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
+static const uint32_t INDEX_NODE_PREFIX_LENGTH_SIZE = sizeof(uint8_t);
+static const uint32_t INDEX_NODE_PREFIX_LENGTH_OFFSET = INDEX_NODE_NUM_CELLS_OFFSET + INDEX_NODE_NUM_CELLS_SIZE;
+// the next leaf on leaves, the right child on internal nodes
+static const uint32_t INDEX_NODE_LINK_SIZE = sizeof(uint32_t);
+static const uint32_t INDEX_NODE_LINK_OFFSET = INDEX_NODE_PREFIX_LENGTH_OFFSET + INDEX_NODE_PREFIX_LENGTH_SIZE;
+static const uint32_t INDEX_NODE_HEADER_SIZE = INDEX_NODE_LINK_OFFSET + INDEX_NODE_LINK_SIZE;
+
+// index node body layout: [header][prefix][slots][free space][cells]
+// every key of a node starts with the prefix, so a cell only keeps the rest of it: [suffix length][suffix][id], then
+// the child on internal nodes. Keys are (column value, id) pairs, the id tells apart rows sharing a value
+static const uint32_t INDEX_NODE_SLOT_SIZE = sizeof(uint16_t);
+static const uint32_t INDEX_CELL_SUFFIX_LENGTH_SIZE = sizeof(uint8_t);
+static const uint32_t INDEX_CELL_ID_SIZE = sizeof(uint32_t);
+static const uint32_t INDEX_CELL_CHILD_SIZE = sizeof(uint32_t);
+static const uint32_t INDEX_NODE_MAX_CELLS =
+    (PAGE_SIZE - INDEX_NODE_HEADER_SIZE) / (INDEX_NODE_SLOT_SIZE + INDEX_CELL_SUFFIX_LENGTH_SIZE + INDEX_CELL_ID_SIZE);
+
+// buffer pool frame, a slot of PAGE_SIZE bytes that holds one cached page
+typedef struct {
+    void* data;
+    uint32_t page_num;  // INVALID_PAGE_NUM when the frame is free
+    uint32_t pin_count;  // frames with a pin count greater than zero are never evicted
+    uint32_t hash_next;  // next frame in the same page table bucket
+    bool referenced;  // CLOCK second chance bit
+    bool dirty;  // changed since it was loaded or last written back
+    // the page is being read in or written back without the pool lock, the frame is pinned meanwhile and the threads
+    // wanting it wait on `io_done`
+    bool io_pending;
+    pthread_cond_t io_done;
+    pthread_rwlock_t latch;  // guards the page contents, only held by threads that also pin the frame
+} Frame;
+
+typedef enum { WAL_PAGE_DELTA = 1, WAL_COMMIT = 2 } WalRecordType;
+
+// write-ahead log file layout: a WalHeader followed by records, a record is a WalRecordHeader followed by `length`
+// bytes of payload. The checksum covers the record (header included, from page_num on) and is seeded with the salt,
+// which changes on every checkpoint, so records left behind by a previous generation of the log never validate
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t salt;
+} WalHeader;
+
+typedef struct {
+    uint32_t crc;
+    uint32_t page_num;  // WAL_COMMIT: the number of pages of the database after the commit
+    uint16_t offset;  // WAL_PAGE_DELTA: where the payload goes inside the page
+    uint16_t length;
+    uint8_t type;
+    uint8_t reserved[3];
+} WalRecordHeader;
 
 typedef struct {
     int fd;
-    uint32_t file_length;
+    uint32_t salt;
+    uint32_t commit_window_ms;  // how long the writer thread gathers commits before it syncs them together
+    bool synchronous;  // commits wait until they are durable instead of returning once they are appended
+    uint64_t checkpoint_bytes;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;  // signals the writer thread that commits are waiting to be synced
+    pthread_cond_t synced;  // broadcast whenever durable_lsn moves forward
+    pthread_t writer;
+    bool running;
+    bool syncing;  // a group sync is in flight, the others wait for it instead of issuing their own
+    char* buffer;  // appended records not handed to a sync yet
+    size_t buffer_length;
+    size_t buffer_capacity;
+    char* spare;  // swapped with buffer while a sync writes it out
+    size_t spare_capacity;
+    uint64_t append_lsn;  // log offset past the last appended record
+    uint64_t durable_lsn;  // log offset up to which everything is fdatasync'ed
+} Wal;
+
+typedef enum {
+    PAGER_BUFFERED,  // buffer pool in one anonymous mapping, filled with pread/pwrite
+    PAGER_MMAP,  // pages handed out straight from a shared mapping of the file
+    PAGER_DIRECT,  // same buffer pool with the file opened O_DIRECT, pages skip the kernel page cache
+} PagerMode;
+
+// committed image of a page kept for the snapshots that began before the writer changed it
+typedef struct PageVersion {
+    uint32_t page_num;
+    uint64_t end_seq;  // the commit that replaced the image, the snapshots taken before it read this one
+    struct PageVersion* next;  // next version in the same bucket, newer versions come first
+    void* data;
+} PageVersion;
+
+typedef struct Snapshot Snapshot;
+
+typedef enum {
+    LATCH_SHARED,  // readers, any number at once
+    LATCH_EXCLUSIVE,  // the writer changing the page
+} LatchMode;
+
+// NOTE: `lock` guards the bookkeeping of the pager (page table, pins, dirty state, file length), never the contents of
+// a page, those are guarded by the page latches
+typedef struct {
+    int fd;
+    PagerMode mode;
+    pthread_mutex_t lock;
+    off_t file_length;
     uint32_t num_pages;
-    void* pages[TABLE_MAX_PAGES];
+    uint32_t num_frames;
+    uint32_t num_used_frames;
+    uint32_t clock_hand;
+    uint32_t bucket_mask;
+    uint32_t* buckets;  // page table, page number hash -> first frame of the chain
+    Frame* frames;
+    void* frame_memory;  // not with PAGER_MMAP, the frames carved out of one mapping, see pager_frame_arena
+    size_t frame_memory_length;
+    uint32_t* flush_list;  // scratch for pager_flush_dirty, sized to num_frames
+    uint32_t num_dirty;
+    uint32_t flush_threshold;
+    void* map;  // PAGER_MMAP only, start of the PAGER_MMAP_RESERVE address space reservation
+    off_t map_length;  // PAGER_MMAP only, bytes of the file currently mapped
+    uint64_t* dirty_bitmap;  // PAGER_MMAP only, one bit per mapped page
+    // PAGER_MMAP only, the page latches of every mapped extent, allocated as the mapping grows so they never move
+    pthread_rwlock_t** latch_extents;
+    Wal* wal;  // NULL when the database runs without a log
+    // pages changed by the running transaction and their contents before it, the pages stay pinned until commit so
+    // uncommitted changes never reach the database file, except under PAGER_MMAP where the kernel writes mapped pages
+    // back whenever it likes. `txn_active` changes under `lock`, snapshots read it
+    bool txn_active;
+    uint32_t txn_num_pages;
+    uint32_t txn_capacity;
+    uint32_t* txn_page_nums;
+    void** txn_pages;
+    void** txn_pre_images;
+    uint64_t commit_seq;  // transactions committed so far, with or without a log
+    Snapshot* snapshots;  // open snapshots, newest first
+    PageVersion** version_buckets;  // page number hash -> versions kept for the open snapshots
+    uint32_t num_versions;
+    PageVersion* free_versions;  // pruned versions kept for reuse, chained through `next`
+    // pages read from and written to the database file, a mapped page is only counted when it's synced
+    uint64_t pages_read;
+    uint64_t pages_written;
+    // buffer pool lookups that found the page cached or had to load it, and the pages pushed out to make room
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t pages_evicted;
 } Pager;
 
+typedef struct {
+    PagerMode pager_mode;
+    uint32_t cache_frames;  // buffer pool budget in pages, 0 means PAGER_DEFAULT_FRAMES
+    uint32_t flush_threshold;  // dirty pages written back after a statement, 0 means PAGER_DEFAULT_FLUSH_THRESHOLD
+    bool disable_wal;
+    bool synchronous_commit;
+    uint32_t commit_window_ms;  // group commit window, 0 means WAL_DEFAULT_COMMIT_WINDOW_MS
+    uint64_t checkpoint_bytes;  // log size that triggers a checkpoint, 0 means WAL_DEFAULT_CHECKPOINT_BYTES
+    uint32_t scan_threads;  // threads a select may scan with, 0 means one per cpu
+    bool bloom_filters;
+} DbOptions;
+
+// Bloom filter of the keys a leaf ever held. Bits are only ever set, a split leaves them behind in the old leaf, so a
+// snapshot reading an older image of the leaf finds every key of that image in the filter
+typedef struct {
+    uint64_t bits[BLOOM_FILTER_BITS / 64];
+    bool leaf;  // the page is a leaf, its filter was built
+} BloomFilter;
+
+// latencies of one kind of statement, in nanoseconds. Recording one is a few relaxed atomic adds, the threads
+// running statements never wait for each other
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t buckets[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+typedef enum { COLUMN_ID, COLUMN_NAME, COLUMN_EMAIL } Column;
+
+// a key of an index node spelled out in full, nodes are rewritten out of these when they change
+typedef struct {
+    uint8_t length;
+    uint8_t key[EMAIL_SIZE];
+    uint32_t id;
+    uint32_t child;  // internal nodes only
+} IndexEntry;
+
+// B-tree mapping the values of a column to the ids of the rows holding them, its pages live in the database file next
+// to the ones of the table and its root never moves. The catalog page lists the indexes: [magic][number of indexes]
+// then the column and the root page number of every one of them
+typedef struct {
+    Column column;
+    uint32_t root_page_num;
+    uint64_t seq;  // the commit that made the index visible, snapshots taken before it can't use it
+    IndexEntry* entries;  // writer scratch, the cells of the node being changed and the one inserted in it
+} Index;
+
+// any number of threads can read the table at once, but only one writes at a time. Readers and the writer meet on page
+// latches, taken top-down along the tree and left to right along the leaf chain
 typedef struct {
     uint32_t root_page_num;
     Pager* pager;
+    pthread_mutex_t writer_lock;  // held by the statement changing the table
+    uint32_t scan_threads;
+    BloomFilter** bloom_extents;  // page number -> filter of the leaf, NULL without DbOptions.bloom_filters
+    // indexes are only ever added, readers load num_indexes and use the entries below it
+    uint32_t num_indexes;
+    Index indexes[INDEX_MAX];
+    uint64_t leaf_splits;  // changed by the writer only
+    uint64_t internal_splits;
+    LatencyHistogram insert_latency;
+    LatencyHistogram select_latency;
 } Table;
 
+// a consistent view of the table as of a commit, the pages the writer changes after it are read from the versions it
+// left behind. Snapshots begin between two statements, never in the middle of one
+struct Snapshot {
+    Table* table;
+    uint64_t seq;  // commits up to this one are visible
+    uint32_t num_pages;  // pages past these didn't exist yet, no version of them is ever needed
+    Snapshot* next;
+    Snapshot* prev;
+};
+
 typedef struct {
     Table* table;
     uint32_t page_num;
     uint32_t cell_num;
     bool end_of_table;
+    uint32_t depth;  // number of internal nodes above the leaf
+    uint32_t path[BTREE_MAX_HEIGHT];  // internal nodes visited from the root down to the leaf
+    // the leaf is latched for as long as the cursor is open, the internal nodes from path[latch_depth] down stay
+    // exclusively latched too, a split may have to change them
+    void* node;
+    uint32_t latch_depth;
+    // a snapshot cursor holds no latch, its leaf is a version of the page or a private copy taken under a short latch
+    Snapshot* snapshot;
+    void* leaf_copy;
 } Cursor;
 
-typedef enum { NODE_INTERNAL, NODE_LEAF } NodeType;
+// builds the tree bottom-up out of rows given in key order: leaves are filled one after the other and chained, then
+// every internal level is built over the one below it, the root is only written at the end
+typedef struct {
+    Table* table;
+    uint32_t leaf_capacity;  // bytes of cells per leaf, from the fill factor
+    uint32_t internal_capacity;  // children per internal node, from the fill factor
+    uint32_t leaf_page_num;  // leaf being filled, INVALID_PAGE_NUM before the first row
+    void* leaf;
+    uint32_t num_rows;
+    uint32_t last_key;
+    uint32_t txn_pages;  // pages built by the running transaction
+    // greatest key and page number of every node of the level being built
+    uint32_t level_count;
+    uint32_t level_capacity;
+    uint32_t* level_keys;
+    uint32_t* level_pages;
+    uint32_t* level_rows;  // rows under every node of the level
+} BulkLoader;
+
+typedef enum { EXPORT_CSV, EXPORT_BINARY } ExportFormat;
+
+// header of a binary export. The columns follow it, each one starting on a page boundary so it can be mapped on its
+// own: the ids, then the names and the emails padded with '\0' to name_width and email_width bytes, rows in key order
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t num_rows;
+    uint64_t id_offset;
+    uint64_t name_offset;
+    uint64_t email_offset;
+    uint32_t name_width;
+    uint32_t email_width;
+} ExportHeader;
+
+// bytes of an export waiting to be written at `offset` of the output file
+typedef struct {
+    int fd;
+    uint64_t offset;
+    uint32_t length;
+    char* data;
+} ExportBuffer;
+
+typedef enum { NODE_INTERNAL, NODE_LEAF, NODE_INDEX_INTERNAL, NODE_INDEX_LEAF } NodeType;
 
 void row_serialize(Row* source, void* desctination);
 void row_deserialize(void* source, Row* destination);
+uint32_t row_serialized_size(Row* row);
+uint32_t row_payload_size(void* payload);
+bool row_payload_valid(const void* payload, uint32_t size);
+const uint8_t* row_payload_column(const void* payload, Column column, uint32_t* length);
 void* cursor_value(Cursor* cursor);
 Table* new_table();
-void show_row(Row* row);
-Pager* pager_open(const char* filename);
-Table* db_open(const char* filename);
+void show_row(FILE* output, Row* row);
+void* pager_frame_arena(uint32_t num_frames, size_t* length);
+uint32_t pager_direct_alignment(int fd);
+Pager* pager_open(const char* filename, PagerMode mode, uint32_t num_frames, uint32_t flush_threshold);
+Table* db_open(const char* filename, DbOptions* options);
 void db_close(Table* table);
 
 #endif
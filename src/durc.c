@@ -0,0 +1,130 @@
+#include "main.h"
+#include "db/layout.h"
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+int
+main(int argc, char** argv) {
+    static struct option long_options[] = {
+        {"cache-pages", required_argument, NULL, 'c'},
+        {"mmap", no_argument, NULL, 'm'},
+        {"direct", no_argument, NULL, 'D'},
+        {"flush-pages", required_argument, NULL, 'F'},
+        {"no-wal", no_argument, NULL, 'n'},
+        {"sync-commit", no_argument, NULL, 's'},
+        {"commit-window-ms", required_argument, NULL, 'w'},
+        {"serve", required_argument, NULL, 'S'},
+        {"workers", required_argument, NULL, 'W'},
+        {"scan-threads", required_argument, NULL, 't'},
+        {"bloom", no_argument, NULL, 'B'},
+        {"batch", no_argument, NULL, 'b'},
+        {"file", required_argument, NULL, 'f'},
+        {NULL, 0, NULL, 0},
+    };
+
+    DbOptions options = {0};
+    char* serve_address = NULL;
+    char* script = NULL;
+    bool batch = false;
+    long num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "c:mDF:nsw:S:W:t:Bbf:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c':
+                options.cache_frames = atoi(optarg);
+                break;
+            case 'm':
+                options.pager_mode = PAGER_MMAP;
+                break;
+            case 'D':
+                options.pager_mode = PAGER_DIRECT;
+                break;
+            case 'F':
+                options.flush_threshold = atoi(optarg);
+                break;
+            case 'n':
+                options.disable_wal = true;
+                break;
+            case 's':
+                options.synchronous_commit = true;
+                break;
+            case 'w':
+                options.commit_window_ms = atoi(optarg);
+                break;
+            case 'S':
+                serve_address = optarg;
+                break;
+            case 'W':
+                num_workers = atoi(optarg);
+                break;
+            case 't':
+                options.scan_threads = atoi(optarg);
+                break;
+            case 'B':
+                options.bloom_filters = true;
+                break;
+            case 'b':
+                batch = true;
+                break;
+            case 'f':
+                script = optarg;
+                batch = true;
+                break;
+            default:
+                printf("usage: %s [--cache-pages N] [--mmap | --direct] [--flush-pages N] [--no-wal] [--sync-commit] "
+                       "[--commit-window-ms N] [--scan-threads N] [--bloom] [--serve <port|unix-socket> [--workers N]] "
+                       "[--batch | -f <script>] <database-storage-filename>\n"
+                       "--mmap gives up crash atomicity, a crash halfway through a statement can leave part of it in "
+                       "the database file\n",
+                       argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (optind >= argc) {
+        printf("must supply a database filename\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char* filename = argv[optind];
+
+    if (serve_address != NULL) {
+        server_run(filename, &options, serve_address, num_workers < 1 ? 1 : num_workers);
+        exit(EXIT_SUCCESS);
+    }
+
+    Table* table = db_open(filename, &options);
+
+    if (batch) {
+        batch_run(table, script);
+        exit(EXIT_SUCCESS);
+    }
+
+    InputBuffer* input_buffer = new_input_buffer();
+
+    while (true) {
+        display_prompt();
+
+        if (!read_input(input_buffer)) {
+            // end of input closes the database the same way `.exit` does
+            db_close(table);
+            exit(EXIT_SUCCESS);
+        }
+
+        if (input_buffer->buffer[0] == '.') {
+            switch (exec_meta_cmd(input_buffer, table)) {
+                case (META_CMD_SUCCESS):
+                    continue;
+                case (META_CMD_UNRECOGNIZED_COMMAND):
+                    printf("unrecognized command: '%s'\n", input_buffer->buffer);
+                    continue;
+            }
+        }
+
+        run_statement(input_buffer->buffer, table, stdout);
+    }
+}
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE  // qsort_r, IOV_MAX, pthread_rwlockattr_setkind_np, O_DIRECT, statx
+
 #include "main.h"
 #include "db/layout.h"
 #include <errno.h>
@@ -5,65 +7,62 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
-int
-main(int argc, char** argv) {
-    if (argc < 2) {
-        printf("must supply a database filename\n");
-        exit(EXIT_FAILURE);
-    }
-
-    char* filename = argv[1];
-    Table* table = db_open(filename);
-    InputBuffer* input_buffer = new_input_buffer();
-
-    while (true) {
-        display_prompt();
-        read_input(input_buffer);
-
-        if (input_buffer->buffer[0] == '.') {
-            switch (exec_meta_cmd(input_buffer, table)) {
-                case (META_CMD_SUCCESS):
-                    continue;
-                case (META_CMD_UNRECOGNIZED_COMMAND):
-                    printf("unrecognized command: '%s'\n", input_buffer->buffer);
-                    continue;
-            }
-        }
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
-        Statement statement;
+// parses and runs one statement, the rows it selects and the line telling how it went are written to `output`
+void
+run_statement(char* input, Table* table, FILE* output) {
+    Statement statement;
 
-        switch (prepare_statement(input_buffer, &statement)) {
-            case (PREP_SUCCESS):
-                break;
-            case (PREP_UNRECOGNIZED_STATEMENT):
-                printf("unrecognized keyword at start of '%s'\n", input_buffer->buffer);
-                continue;
-            case (PREP_STR_TOO_LONG):
-                printf("string is too long to persistency\n");
-                continue;
-            case (PREP_NEGATIVE_ROW_ID):
-                printf("row id must be a positive value\n");
-                continue;
-            case (PREP_SYNTAX_ERROR):
-                printf("syntax error, could not parse statement\n");
-                continue;
-        }
+    switch (prepare_statement(input, &statement, NULL)) {
+        case (PREP_SUCCESS):
+            break;
+        case (PREP_UNRECOGNIZED_STATEMENT):
+            fprintf(output, "unrecognized keyword at start of '%s'\n", input);
+            return;
+        case (PREP_STR_TOO_LONG):
+            fprintf(output, "string is too long to persistency\n");
+            return;
+        case (PREP_NEGATIVE_ROW_ID):
+            fprintf(output, "row id must be a positive value\n");
+            return;
+        case (PREP_SYNTAX_ERROR):
+            fprintf(output, "syntax error, could not parse statement\n");
+            return;
+    }
 
-        switch (exec_statement(&statement, table)) {
-            case (EXEC_RES_SUCCESS):
-                printf("executed\n");
-                break;
-            case (EXEC_RES_TABLE_FULL):
-                printf("ERR: full table\n");
-                break;
-            case (EXEC_DUPLICATE_KEY):
-                printf("ERR: duplicated key\n");
-                break;
-        }
+    switch (exec_statement(&statement, table, output)) {
+        case (EXEC_RES_SUCCESS):
+            fprintf(output, "executed\n");
+            break;
+        case (EXEC_RES_TABLE_FULL):
+            fprintf(output, "ERR: full table\n");
+            break;
+        case (EXEC_DUPLICATE_KEY):
+            fprintf(output, "ERR: duplicated key\n");
+            break;
+        default:
+            break;
     }
 }
 
@@ -83,641 +82,5921 @@ display_prompt() {
     printf("db: ");
 }
 
-void
+// false once there's nothing left to read
+bool
 read_input(InputBuffer* input_buffer) {
     ssize_t bytes_read = getline(&(input_buffer->buffer), &(input_buffer->buffer_length), stdin);
 
     if (bytes_read <= 0) {
-        // printf("error reading input\n");
-        exit(EXIT_FAILURE);
+        return false;
     }
 
-    input_buffer->buffer[bytes_read - 1] = 0;
-    input_buffer->input_length = bytes_read - 1;
-}
+    if (input_buffer->buffer[bytes_read - 1] == '\n') {
+        bytes_read -= 1;
+    }
 
-MetaCmdResult
-exec_meta_cmd(InputBuffer* input_buffer, Table* table) {
-    if (strcmp(input_buffer->buffer, ".exit") == 0) {
-        db_close(table);
-        exit(EXIT_SUCCESS);
-    } else if (strcmp(input_buffer->buffer, ".const") == 0) {
-        display_constants();
-        return META_CMD_SUCCESS;
-    } else if (strcmp(input_buffer->buffer, ".btree") == 0) {
-        printf("TREE\n");
-        display_tree(table->pager, 0, 0);
+    input_buffer->buffer[bytes_read] = 0;
+    input_buffer->input_length = bytes_read;
 
-        return META_CMD_SUCCESS;
-    } else {
-        return META_CMD_UNRECOGNIZED_COMMAND;
-    }
+    return true;
 }
 
-PrepareResult
-prepare_statement(InputBuffer* input_buffer, Statement* statement) {
-    if (strncmp(input_buffer->buffer, "insert", 6) == 0) {
-        statement->type = STMT_INSERT;
+// the filter of a leaf, allocated along with its extent when `create` is set. NULL without Bloom filters or past the
+// pages the directory covers
+BloomFilter*
+bloom_filter(Table* table, uint32_t page_num, bool create) {
+    uint32_t extent_num = page_num / BLOOM_EXTENT_FILTERS;
 
-        __attribute__((unused)) char* keyword = strtok(input_buffer->buffer, " ");
-        char* row_id_str = strtok(NULL, " ");
-        char* username = strtok(NULL, " ");
-        char* email = strtok(NULL, " ");
+    if (table->bloom_extents == NULL || extent_num >= BLOOM_MAX_EXTENTS) {
+        return NULL;
+    }
 
-        if (row_id_str == NULL || username == NULL || email == NULL) {
-            return PREP_SYNTAX_ERROR;
-        }
+    BloomFilter* extent = __atomic_load_n(&(table->bloom_extents[extent_num]), __ATOMIC_ACQUIRE);
 
-        int row_id = atoi(row_id_str);
+    if (extent == NULL && create) {
+        // NOTE: only the writer creates extents, readers see either NULL or the zeroed extent
+        extent = calloc(BLOOM_EXTENT_FILTERS, sizeof(BloomFilter));
+        __atomic_store_n(&(table->bloom_extents[extent_num]), extent, __ATOMIC_RELEASE);
+    }
 
-        if (row_id < 0) {
-            return PREP_NEGATIVE_ROW_ID;
-        }
+    return extent == NULL ? NULL : &(extent[page_num % BLOOM_EXTENT_FILTERS]);
+}
 
-        if (strlen(username) > EMAIL_SIZE || strlen(email) > NAME_SIZE) {
-            return PREP_STR_TOO_LONG;
-        }
+// the probes are spread with double hashing over two halves of a 64-bit mix of the key
+uint64_t
+bloom_hash(uint32_t key) {
+    uint64_t hash = key + 0x9e3779b97f4a7c15ULL;
 
-        statement->row.id = row_id;
-        strcpy(statement->row.name, username);
-        strcpy(statement->row.email, email);
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
 
-        return PREP_SUCCESS;
-    } else if (strncmp(input_buffer->buffer, "select", 6) == 0) {
-        statement->type = STMT_SELECT;
-        return PREP_SUCCESS;
-    } else {
-        return PREP_UNRECOGNIZED_STATEMENT;
-    }
+    return hash ^ (hash >> 31);
 }
 
-ExecuteResult
-exec_stmt_insert(Statement* statement, Table* table) {
-    void* node = get_page(table->pager, table->root_page_num);
-    uint32_t num_cells = (*leaf_node_num_cells(node));
-
-    Row* row = &(statement->row);
-    uint32_t key = row->id;
-    Cursor* cursor = table_find(table, key);
-
-    if (cursor->cell_num < num_cells) {
-        uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
+void
+bloom_add(Table* table, uint32_t page_num, uint32_t key) {
+    BloomFilter* filter = bloom_filter(table, page_num, true);
 
-        if (key_at_index == key) {
-            return EXEC_DUPLICATE_KEY;
-        }
+    if (filter == NULL) {
+        return;
     }
 
-    leaf_node_insert(cursor, key, row);
-
-    free(cursor);
-
-    return EXEC_RES_SUCCESS;
-}
+    uint64_t hash = bloom_hash(key);
+    uint32_t h1 = hash;
+    uint32_t h2 = (hash >> 32) | 1;
 
-ExecuteResult
-exec_stmt_select(Table* table) {
-    Cursor* cursor = table_start(table);
-    Row row;
+    for (uint32_t i = 0; i < BLOOM_FILTER_HASHES; i++) {
+        uint32_t bit = (h1 + i * h2) % BLOOM_FILTER_BITS;
 
-    while (!(cursor->end_of_table)) {
-        row_deserialize(cursor_value(cursor), &row);
-        show_row(&row);
-        cursor_advance(cursor);
+        __atomic_fetch_or(&(filter->bits[bit / 64]), 1ULL << (bit % 64), __ATOMIC_RELAXED);
     }
 
-    free(cursor);
-
-    return EXEC_RES_SUCCESS;
+    __atomic_store_n(&(filter->leaf), true, __ATOMIC_RELEASE);
 }
 
-ExecuteResult
-exec_statement(Statement* statement, Table* table) {
-    switch (statement->type) {
-        case (STMT_INSERT):
-            return exec_stmt_insert(statement, table);
-        case (STMT_SELECT):
-            return exec_stmt_select(table);
+void
+bloom_add_leaf(Table* table, uint32_t page_num, void* node) {
+    for (uint32_t i = 0; i < *leaf_node_num_cells(node); i++) {
+        bloom_add(table, page_num, *leaf_node_key(node, i));
     }
 }
 
-void
-row_serialize(Row* source, void* destination) {
-    memcpy(destination + SCHEMA_ID_OFFSET, &(source->id), SCHEMA_ID_SIZE);
-    memcpy(destination + SCHEMA_NAME_OFFSET, &(source->name), SCHEMA_NAME_SIZE);
-    memcpy(destination + SCHEMA_EMAIL_OFFSET, &(source->email), SCHEMA_EMAIL_SIZE);
-}
+bool
+bloom_may_contain(BloomFilter* filter, uint32_t key) {
+    uint64_t hash = bloom_hash(key);
+    uint32_t h1 = hash;
+    uint32_t h2 = (hash >> 32) | 1;
 
-void
-row_deserialize(void* source, Row* destination) {
-    memcpy(&(destination->id), source + SCHEMA_ID_OFFSET, SCHEMA_ID_SIZE);
-    memcpy(&(destination->name), source + SCHEMA_NAME_OFFSET, SCHEMA_NAME_SIZE);
-    memcpy(&(destination->email), source + SCHEMA_EMAIL_OFFSET, SCHEMA_EMAIL_SIZE);
-}
+    for (uint32_t i = 0; i < BLOOM_FILTER_HASHES; i++) {
+        uint32_t bit = (h1 + i * h2) % BLOOM_FILTER_BITS;
 
-void*
-cursor_value(Cursor* cursor) {
-    uint32_t page_num = cursor->page_num;
-    void* page = get_page(cursor->table->pager, page_num);
+        if ((__atomic_load_n(&(filter->bits[bit / 64]), __ATOMIC_RELAXED) & (1ULL << (bit % 64))) == 0) {
+            return false;
+        }
+    }
 
-    return leaf_node_value(page, cursor->cell_num);
+    return true;
 }
 
+// the filters only live in memory, opening the table walks the leaf chain once to fill them
 void
-show_row(Row* row) {
-    printf("-- %d %s %s\n", row->id, row->name, row->email);
-}
+table_bloom_build(Table* table) {
+    table->bloom_extents = calloc(BLOOM_MAX_EXTENTS, sizeof(BloomFilter*));
 
-void*
-get_page(Pager* pager, uint32_t page_num) {
-    if (page_num > TABLE_MAX_PAGES) {
-        printf("tried to fetch page number out of bounds %d > %d\n", page_num, TABLE_MAX_PAGES);
-        exit(EXIT_FAILURE);
-    }
+    Cursor* cursor = table_find(table, 0, LATCH_SHARED);
+
+    do {
+        bloom_add_leaf(table, cursor->page_num, cursor->node);
+    } while (cursor_next_leaf(cursor));
 
-    if (pager->pages[page_num] == NULL) {
-        // cache miss. Allocate memory and load from file
-        void* page = malloc(PAGE_SIZE);
-        uint32_t num_pages = pager->file_length / PAGE_SIZE;
+    cursor_close(cursor);
+}
 
-        // we might save a partial page at the end of the file
-        if (pager->file_length % PAGE_SIZE) {
-            num_pages += 1;
+// runs the statements of a script, or of stdin when `script` is NULL, then closes the table. Nothing is echoed and
+// answers pile up in one large output buffer, so a script only costs a write per BATCH_OUTPUT_SIZE bytes of output
+void
+batch_run(Table* table, const char* script) {
+    setvbuf(stdout, NULL, _IOFBF, BATCH_OUTPUT_SIZE);
+    // NOTE: only this thread writes to stdout, the stream doesn't need to be locked on every row
+    __fsetlocking(stdout, FSETLOCKING_BYCALLER);
+
+    if (script != NULL) {
+        int fd = open(script, O_RDONLY);
+        struct stat st;
+
+        if (fd == -1 || fstat(fd, &st) == -1) {
+            printf("unable to open script %s\n", script);
+            exit(EXIT_FAILURE);
         }
 
-        if (page_num <= num_pages) {
-            lseek(pager->fd, page_num * PAGE_SIZE, SEEK_SET);
-            ssize_t bytes_read = read(pager->fd, page, PAGE_SIZE);
+        if (st.st_size > 0) {
+            // NOTE: a private writable mapping, lines are cut in place and the file is left untouched
+            char* data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
 
-            if (bytes_read == -1) {
-                printf("error reading file: %d\n", errno);
+            if (data == MAP_FAILED) {
+                printf("unable to map script %s\n", script);
                 exit(EXIT_FAILURE);
             }
+
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            batch_run_lines(table, data, st.st_size, true);
+            munmap(data, st.st_size);
         }
 
-        pager->pages[page_num] = page;
+        close(fd);
+    } else {
+        char* buffer = malloc(BATCH_READ_SIZE);
+        size_t capacity = BATCH_READ_SIZE;
+        size_t length = 0;
+
+        while (true) {
+            if (length == capacity) {
+                // a single line longer than the buffer
+                capacity *= 2;
+                buffer = realloc(buffer, capacity);
+            }
 
-        if (page_num >= pager->num_pages) {
-            pager->num_pages += 1;
-        }
-    }
+            ssize_t bytes_read = read(STDIN_FILENO, buffer + length, capacity - length);
 
-    return pager->pages[page_num];
-}
+            if (bytes_read == -1 && errno == EINTR) {
+                continue;
+            }
 
-Pager*
-pager_open(const char* filename) {
-    int fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+            if (bytes_read <= 0) {
+                batch_run_lines(table, buffer, length, true);
+                break;
+            }
 
-    if (fd == -1) {
-        printf("unable to open file\n");
-        exit(EXIT_FAILURE);
-    }
+            length += bytes_read;
 
-    off_t file_length = lseek(fd, 0, SEEK_END);
+            size_t consumed = batch_run_lines(table, buffer, length, false);
 
-    Pager* pager = malloc(sizeof(Pager));
-    pager->fd = fd;
-    pager->file_length = file_length;
-    pager->num_pages = (file_length / PAGE_SIZE);
+            memmove(buffer, buffer + consumed, length - consumed);
+            length -= consumed;
+        }
 
-    if (file_length % PAGE_SIZE != 0) {
-        printf("db file is not a whole number of pages. corrupted file\n");
-        exit(EXIT_FAILURE);
+        free(buffer);
     }
 
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-        pager->pages[i] = NULL;
+    db_close(table);
+}
+
+// runs every complete line of `data` and returns how many bytes they took, at the end of the input the last line
+// doesn't need a newline
+size_t
+batch_run_lines(Table* table, char* data, size_t length, bool end_of_input) {
+    size_t consumed = 0;
+
+    while (consumed < length) {
+        char* line = data + consumed;
+        char* end = memchr(line, '\n', length - consumed);
+        char* last_line = NULL;
+
+        if (end != NULL) {
+            *end = 0;
+            consumed = end - data + 1;
+        } else if (end_of_input) {
+            // NOTE: there may be no room past the input for the terminating '\0'
+            last_line = strndup(line, length - consumed);
+            line = last_line;
+            consumed = length;
+        } else {
+            break;
+        }
+
+        batch_run_line(table, line);
+        free(last_line);
     }
 
-    return pager;
+    return consumed;
 }
 
 void
-pager_flush(Pager* pager, uint32_t page_num) {
-    if (pager->pages[page_num] == NULL) {
-        printf("tried to flush a null page\n");
-        exit(EXIT_FAILURE);
-    }
+batch_run_line(Table* table, char* line) {
+    size_t length = strlen(line);
 
-    off_t offset = lseek(pager->fd, page_num * PAGE_SIZE, SEEK_SET);
-
-    if (offset == -1) {
-        printf("error seeking: %d\n", errno);
-        exit(EXIT_FAILURE);
+    if (length > 0 && line[length - 1] == '\r') {
+        line[--length] = 0;
     }
 
-    ssize_t bytes_written = write(pager->fd, pager->pages[page_num], PAGE_SIZE);
-
-    if (bytes_written == -1) {
-        printf("error writing: %d\n", errno);
-        exit(EXIT_FAILURE);
+    if (length == 0) {
+        return;
     }
-}
 
-Table*
-db_open(const char* filename) {
-    Pager* pager = pager_open(filename);
+    if (line[0] == '.') {
+        InputBuffer input_buffer = {.buffer = line, .buffer_length = length + 1, .input_length = length};
 
-    Table* table = malloc(sizeof(Table));
-    table->pager = pager;
-    table->root_page_num = 0;
+        if (exec_meta_cmd(&input_buffer, table) == META_CMD_UNRECOGNIZED_COMMAND) {
+            printf("unrecognized command: '%s'\n", line);
+        }
 
-    if (pager->num_pages == 0) {
-        void* root_node = get_page(pager, 0);
-        init_leaf_node(root_node);
-        set_node_root(root_node, true);
+        return;
     }
 
-    return table;
+    run_statement(line, table, stdout);
 }
 
-void
-db_close(Table* table) {
-    Pager* pager = table->pager;
+MetaCmdResult
+exec_meta_cmd(InputBuffer* input_buffer, Table* table) {
+    if (strcmp(input_buffer->buffer, ".exit") == 0) {
+        db_close(table);
+        exit(EXIT_SUCCESS);
+    } else if (strcmp(input_buffer->buffer, ".const") == 0) {
+        display_constants();
+        return META_CMD_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".btree") == 0) {
+        printf("TREE\n");
+        display_tree(table->pager, 0, 0);
 
-    for (uint32_t i = 0; i < pager->num_pages; i++) {
-        if (pager->pages[i] == NULL) {
-            continue;
+        return META_CMD_SUCCESS;
+    } else if (strncmp(input_buffer->buffer, ".load ", 6) == 0) {
+        __attribute__((unused)) char* keyword = strtok(input_buffer->buffer, " ");
+        char* filename = strtok(NULL, " ");
+        char* fill_percent_str = strtok(NULL, " ");
+        int fill_percent = fill_percent_str == NULL ? BULK_LOAD_DEFAULT_FILL_PERCENT : atoi(fill_percent_str);
+
+        if (filename == NULL || fill_percent < 1 || fill_percent > 100) {
+            printf("usage: .load <file> [fill-percent]\n");
+            return META_CMD_SUCCESS;
         }
 
-        pager_flush(pager, i);
-        free(pager->pages[i]);
-        pager->pages[i] = NULL;
-    }
+        uint32_t num_rows = 0;
 
-    int result = close(pager->fd);
+        switch (table_load_file(table, filename, fill_percent, &num_rows)) {
+            case (EXEC_TABLE_NOT_EMPTY):
+                printf("ERR: bulk load needs an empty table\n");
+                break;
+            case (EXEC_DUPLICATE_KEY):
+                printf("ERR: duplicated key after loading %d rows\n", num_rows);
+                break;
+            case (EXEC_BAD_INPUT):
+                break;
+            default:
+                printf("loaded %d rows\n", num_rows);
+                break;
+        }
 
-    if (result == -1) {
-        printf("error closing db file\n");
-        exit(EXIT_FAILURE);
-    }
+        return META_CMD_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".stats") == 0 || strcmp(input_buffer->buffer, ".stats json") == 0) {
+        table_stats_print(table, stdout, strcmp(input_buffer->buffer, ".stats json") == 0);
 
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-        void* page = pager->pages[i];
+        return META_CMD_SUCCESS;
+    } else if (strncmp(input_buffer->buffer, ".index ", 7) == 0) {
+        __attribute__((unused)) char* keyword = strtok(input_buffer->buffer, " ");
+        char* action = strtok(NULL, " ");
+        char* column_str = strtok(NULL, " ");
+        Column column = COLUMN_ID;
+
+        if (column_str != NULL && strcmp(column_str, "name") == 0) {
+            column = COLUMN_NAME;
+        } else if (column_str != NULL && strcmp(column_str, "email") == 0) {
+            column = COLUMN_EMAIL;
+        }
 
-        if (page) {
-            free(page);
-            pager->pages[i] = NULL;
+        if (action == NULL || strcmp(action, "create") != 0 || column == COLUMN_ID) {
+            printf("usage: .index create <name|email>\n");
+            return META_CMD_SUCCESS;
         }
-    }
 
-    free(pager);
-    free(table);
-}
+        uint64_t num_rows = 0;
 
-Cursor*
-table_start(Table* table) {
-    Cursor* cursor = malloc(sizeof(Cursor));
+        if (table_index_create(table, column, &num_rows) == EXEC_DUPLICATE_KEY) {
+            printf("ERR: %s is already indexed\n", column_str);
+        } else {
+            printf("indexed %lu rows\n", num_rows);
+        }
 
-    cursor->table = table;
-    cursor->page_num = table->root_page_num;
-    cursor->cell_num = 0;
+        return META_CMD_SUCCESS;
+    } else if (strncmp(input_buffer->buffer, ".export ", 8) == 0) {
+        __attribute__((unused)) char* keyword = strtok(input_buffer->buffer, " ");
+        char* filename = strtok(NULL, " ");
+        char* format_str = strtok(NULL, " ");
+        ExportFormat format = EXPORT_CSV;
+
+        if (format_str != NULL && strcmp(format_str, "binary") == 0) {
+            format = EXPORT_BINARY;
+        } else if (format_str != NULL && strcmp(format_str, "csv") != 0) {
+            filename = NULL;
+        }
 
-    void* root_node = get_page(table->pager, table->root_page_num);
-    uint32_t num_cells = *leaf_node_num_cells(root_node);
-    cursor->end_of_table = (num_cells == 0);
+        if (filename == NULL) {
+            printf("usage: .export <file> [csv|binary]\n");
+            return META_CMD_SUCCESS;
+        }
 
-    return cursor;
-}
+        uint64_t num_rows = 0;
 
-void
-cursor_advance(Cursor* cursor) {
-    uint32_t page_num = cursor->page_num;
-    void* node = get_page(cursor->table->pager, page_num);
-    cursor->cell_num += 1;
+        if (table_export(table, filename, format, &num_rows) == EXEC_RES_SUCCESS) {
+            printf("exported %lu rows\n", num_rows);
+        }
 
-    if (cursor->cell_num >= (*leaf_node_num_cells(node))) {
-        cursor->end_of_table = true;
+        return META_CMD_SUCCESS;
+    } else {
+        return META_CMD_UNRECOGNIZED_COMMAND;
     }
 }
 
-// NOTE: this functions is used as a pointer arithmetic operations to get the memory address that the value will be
-// stored or accessed
-uint32_t*
-leaf_node_num_cells(void* node) {
-    return node + LEAF_NODE_NUM_CELLS_OFFSET;
-}
+// NOTE: the tokens are split with strtok_r, statements are parsed by every thread serving clients at once. When
+// `prepared` isn't NULL the statement is being prepared and `?` placeholders are taken
+PrepareResult
+prepare_statement(char* input, Statement* statement, PreparedStatement* prepared) {
+    char* save;
 
-void*
-leaf_node_cell(void* node, uint32_t cell_num) {
-    return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
-}
+    statement->format = ROW_FORMAT_TEXT;
 
-uint32_t*
-leaf_node_key(void* node, uint32_t cell_num) {
-    return leaf_node_cell(node, cell_num);
-}
+    if (prepared != NULL) {
+        prepared->num_params = 0;
+    }
 
-void*
-leaf_node_value(void* node, uint32_t cell_num) {
-    return leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE;
-}
+    if (strncmp(input, "insert", 6) == 0) {
+        statement->type = STMT_INSERT;
 
-void
-init_leaf_node(void* node) {
-    set_node_type(node, NODE_LEAF);
-    set_node_root(node, false);
-    *leaf_node_num_cells(node) = 0;
-}
+        __attribute__((unused)) char* keyword = strtok_r(input, " ", &save);
+        char* row_id_str = strtok_r(NULL, " ", &save);
+        char* username = strtok_r(NULL, " ", &save);
+        char* email = strtok_r(NULL, " ", &save);
 
-void
-leaf_node_insert(Cursor* cursor, uint32_t key, Row* data) {
-    void* node = get_page(cursor->table->pager, cursor->page_num);
-    uint32_t num_cells = *leaf_node_num_cells(node);
+        if (prepared != NULL) {
+            bool placeholders = row_id_str != NULL && username != NULL && email != NULL && strcmp(row_id_str, "?") == 0
+                                && strcmp(username, "?") == 0 && strcmp(email, "?") == 0;
+
+            return placeholders && strtok_r(NULL, " ", &save) == NULL ? PREP_SUCCESS : PREP_SYNTAX_ERROR;
+        }
 
-    if (num_cells >= LEAF_NODE_MAX_CELLS) {
-        leaf_node_split_and_insert(cursor, key, data);
+        return parse_row(row_id_str, username, email, &(statement->row));
+    } else if (strncmp(input, "select", 6) == 0) {
+        statement->type = STMT_SELECT;
 
-        return;
-    }
+        __attribute__((unused)) char* keyword = strtok_r(input, " ", &save);
 
-    // just fill up the bytes like "allocating" ???
-    if (cursor->cell_num < num_cells) {
-        for (uint32_t i = num_cells; i > cursor->cell_num; i--) {
-            memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1), LEAF_NODE_CELL_SIZE);
-        }
+        return parse_select(statement, &save, prepared);
+    } else {
+        return PREP_UNRECOGNIZED_STATEMENT;
     }
-
-    *(leaf_node_num_cells(node)) += 1;
-    *(leaf_node_key(node, cursor->cell_num)) = key;
-    row_serialize(data, leaf_node_value(node, cursor->cell_num));
+}
+
+PrepareResult
+parse_row(char* row_id_str, char* username, char* email, Row* row) {
+    if (row_id_str == NULL || username == NULL || email == NULL) {
+        return PREP_SYNTAX_ERROR;
+    }
+
+    int row_id = atoi(row_id_str);
+
+    if (row_id < 0) {
+        return PREP_NEGATIVE_ROW_ID;
+    }
+
+    if (strlen(username) > NAME_SIZE || strlen(email) > EMAIL_SIZE) {
+        return PREP_STR_TOO_LONG;
+    }
+
+    row->id = row_id;
+    strcpy(row->name, username);
+    strcpy(row->email, email);
+
+    return PREP_SUCCESS;
+}
+
+// parses the clauses following `select`, the first token was already taken by strtok_r
+PrepareResult
+parse_select(Statement* statement, char** save, PreparedStatement* prepared) {
+    SelectRange* range = &(statement->range);
+
+    range->min_id = 0;
+    range->max_id = UINT32_MAX;
+    range->limit = UINT32_MAX;
+    range->offset = 0;
+    statement->kind = SELECT_ROWS;
+    statement->column = COLUMN_ID;
+
+    char* token = strtok_r(NULL, " ", save);
+
+    if (token != NULL && (strcmp(token, "count") == 0 || strcmp(token, "count(*)") == 0)) {
+        statement->kind = SELECT_COUNT;
+        token = strtok_r(NULL, " ", save);
+    } else if (token != NULL && strcmp(token, "rank") == 0) {
+        statement->kind = SELECT_RANK;
+        token = strtok_r(NULL, " ", save);
+    }
+
+    bool point = false;
+
+    if (token != NULL && strcmp(token, "where") == 0) {
+        char* column = strtok_r(NULL, " ", save);
+        char* operator = strtok_r(NULL, " ", save);
+        char* min_id_str = strtok_r(NULL, " ", save);
+
+        if (column == NULL || operator == NULL || min_id_str == NULL) {
+            return PREP_SYNTAX_ERROR;
+        }
+
+        PrepareResult result;
+
+        if (strcmp(column, "id") == 0) {
+            uint8_t min_id_bounds = SELECT_BOUND_MIN_ID;
+            char* max_id_str = NULL;
+
+            if (strcmp(operator, "between") == 0) {
+                char* conjunction = strtok_r(NULL, " ", save);
+
+                max_id_str = strtok_r(NULL, " ", save);
+
+                if (conjunction == NULL || max_id_str == NULL || strcmp(conjunction, "and") != 0) {
+                    return PREP_SYNTAX_ERROR;
+                }
+            } else if (strcmp(operator, "=") == 0) {
+                min_id_bounds |= SELECT_BOUND_MAX_ID;
+                point = true;
+            } else {
+                return PREP_SYNTAX_ERROR;
+            }
+
+            result = parse_select_bound(min_id_str, range, min_id_bounds, prepared);
+
+            if (result == PREP_SUCCESS && max_id_str != NULL) {
+                result = parse_select_bound(max_id_str, range, SELECT_BOUND_MAX_ID, prepared);
+            }
+        } else {
+            result = parse_select_column(statement, column, operator, min_id_str);
+        }
+
+        if (result != PREP_SUCCESS) {
+            return result;
+        }
+
+        token = strtok_r(NULL, " ", save);
+    }
+
+    // a rank is the position of one id
+    if (statement->kind == SELECT_RANK && !point) {
+        return PREP_SYNTAX_ERROR;
+    }
+
+    // `limit` and `offset` come in any order
+    while (token != NULL) {
+        uint8_t bound;
+
+        if (strcmp(token, "limit") == 0) {
+            bound = SELECT_BOUND_LIMIT;
+        } else if (strcmp(token, "offset") == 0) {
+            bound = SELECT_BOUND_OFFSET;
+        } else {
+            return PREP_SYNTAX_ERROR;
+        }
+
+        char* value_str = strtok_r(NULL, " ", save);
+
+        if (value_str == NULL || parse_select_bound(value_str, range, bound, prepared) != PREP_SUCCESS) {
+            return PREP_SYNTAX_ERROR;
+        }
+
+        token = strtok_r(NULL, " ", save);
+    }
+
+    return PREP_SUCCESS;
+}
+
+// `where name = S` or `where email = S`, a string column is only compared for equality, to a literal
+PrepareResult
+parse_select_column(Statement* statement, char* column, char* operator, char* value) {
+    if (strcmp(column, "name") == 0) {
+        statement->column = COLUMN_NAME;
+    } else if (strcmp(column, "email") == 0) {
+        statement->column = COLUMN_EMAIL;
+    } else {
+        return PREP_SYNTAX_ERROR;
+    }
+
+    if (strcmp(operator, "=") != 0 || strcmp(value, "?") == 0) {
+        return PREP_SYNTAX_ERROR;
+    }
+
+    if (strlen(value) > (statement->column == COLUMN_NAME ? NAME_SIZE : EMAIL_SIZE)) {
+        return PREP_STR_TOO_LONG;
+    }
+
+    strcpy(statement->value, value);
+
+    return PREP_SUCCESS;
+}
+
+// sets the bounds of the range a number of a select clause stands for. A `?` leaves them to a parameter of every
+// execution of the prepared statement
+PrepareResult
+parse_select_bound(char* token, SelectRange* range, uint8_t bounds, PreparedStatement* prepared) {
+    if (strcmp(token, "?") == 0) {
+        if (prepared == NULL || prepared->num_params == PREPARED_MAX_PARAMS) {
+            return PREP_SYNTAX_ERROR;
+        }
+
+        prepared->params[prepared->num_params++] = bounds;
+
+        return PREP_SUCCESS;
+    }
+
+    int value = atoi(token);
+
+    if (value < 0) {
+        return PREP_NEGATIVE_ROW_ID;
+    }
+
+    select_range_set(range, bounds, value);
+
+    return PREP_SUCCESS;
+}
+
+void
+select_range_set(SelectRange* range, uint8_t bounds, uint32_t value) {
+    if (bounds & SELECT_BOUND_MIN_ID) {
+        range->min_id = value;
+    }
+
+    if (bounds & SELECT_BOUND_MAX_ID) {
+        range->max_id = value;
+    }
+
+    if (bounds & SELECT_BOUND_LIMIT) {
+        range->limit = value;
+    }
+
+    if (bounds & SELECT_BOUND_OFFSET) {
+        range->offset = value;
+    }
+}
+
+ExecuteResult
+exec_stmt_insert(Statement* statement, Table* table) {
+    uint8_t payload[ROW_MAX_SIZE];
+
+    row_serialize(&(statement->row), payload);
+
+    return table_insert(table, payload, row_serialized_size(&(statement->row)));
+}
+
+// inserts a row encoded the way it's stored, the payload is copied into the leaf as is
+ExecuteResult
+table_insert(Table* table, const void* payload, uint32_t size) {
+    uint32_t key;
+
+    memcpy(&key, payload, SCHEMA_ID_SIZE);
+    pthread_mutex_lock(&(table->writer_lock));
+
+    // NOTE: the cursor lives on the stack, with the versions and the transaction buffers reused an insert that
+    // doesn't grow the database allocates nothing
+    Cursor cursor;
+
+    cursor_find(&cursor, table, key, LATCH_EXCLUSIVE);
+
+    uint32_t num_cells = (*leaf_node_num_cells(cursor.node));
+
+    if (cursor.cell_num < num_cells) {
+        uint32_t key_at_index = *leaf_node_key(cursor.node, cursor.cell_num);
+
+        if (key_at_index == key) {
+            cursor_unlatch(&cursor);
+            pthread_mutex_unlock(&(table->writer_lock));
+
+            return EXEC_DUPLICATE_KEY;
+        }
+    }
+
+    pager_begin(table->pager);
+    leaf_node_insert(&cursor, key, payload, size);
+
+    // the ancestors above the ones still latched weren't changed by a split, they only count one more row
+    uint32_t path[BTREE_MAX_HEIGHT];
+    uint32_t counted_depth = cursor.latch_depth;
+
+    memcpy(path, cursor.path, counted_depth * sizeof(uint32_t));
+
+    // readers may go on as soon as the tree is consistent again, they don't have to wait for the commit
+    cursor_unlatch(&cursor);
+    internal_node_count_row(table, path, counted_depth, key);
+
+    // the indexes change in the same transaction as the table
+    for (uint32_t i = 0; i < table->num_indexes; i++) {
+        uint32_t length;
+        const uint8_t* value = row_payload_column(payload, table->indexes[i].column, &length);
+
+        index_insert(table, &(table->indexes[i]), value, length, key);
+    }
+
+    pager_commit(table->pager);
+    pager_maybe_flush(table->pager);
+
+    pthread_mutex_unlock(&(table->writer_lock));
+
+    return EXEC_RES_SUCCESS;
+}
+
+ExecuteResult
+exec_stmt_select(Statement* statement, Table* table, FILE* output) {
+    // the select reads a snapshot, inserts running meanwhile neither wait for it nor show up halfway through
+    Snapshot snapshot;
+
+    snapshot_open(&snapshot, table);
+    SelectRange range = statement->range;
+
+    if (statement->column != COLUMN_ID) {
+        select_by_column(&snapshot, statement, output);
+        snapshot_close(&snapshot);
+
+        return EXEC_RES_SUCCESS;
+    }
+
+    // a point lookup of an id that isn't there is usually answered without reading the leaf
+    bool point = range.min_id == range.max_id && statement->kind != SELECT_RANK;
+
+    if (point && !snapshot_may_contain(&snapshot, range.min_id)) {
+        range.limit = 0;
+    }
+
+    if (statement->kind != SELECT_ROWS) {
+        // counts and ranks are read off the row counts of the internal nodes, a root-to-leaf path per bound
+        uint64_t answer = snapshot_rank(&snapshot, range.min_id, false);
+
+        if (statement->kind == SELECT_COUNT) {
+            uint64_t end = range.min_id <= range.max_id ? snapshot_rank(&snapshot, range.max_id, true) : answer;
+
+            answer = end - answer > range.offset ? end - answer - range.offset : 0;
+            answer = answer < range.limit ? answer : range.limit;
+        }
+
+        snapshot_close(&snapshot);
+
+        if (statement->format == ROW_FORMAT_BINARY) {
+            fwrite(&answer, sizeof(uint64_t), 1, output);
+        } else {
+            fprintf(output, "-- %lu\n", answer);
+        }
+
+        return EXEC_RES_SUCCESS;
+    }
+
+    // skipping rows doesn't read them, the scan starts from the key at the position the offset leads to
+    if (range.limit == 0) {
+        snapshot_close(&snapshot);
+        return EXEC_RES_SUCCESS;
+    }
+
+    if (range.offset > 0 &&
+        !snapshot_key_at(&snapshot, snapshot_rank(&snapshot, range.min_id, false) + range.offset, &(range.min_id))) {
+        snapshot_close(&snapshot);
+        return EXEC_RES_SUCCESS;
+    }
+
+    ScanPartition* partitions = NULL;
+    uint32_t num_partitions = 1;
+
+    // a select without a limit is split into ranges of whole subtrees scanned by several threads. A range of fewer ids
+    // than any leaf holds rows, a point select included, is read by this thread without looking for partitions
+    bool small = (uint64_t) range.max_id < (uint64_t) range.min_id + LEAF_NODE_MIN_CELLS;
+
+    if (range.limit == UINT32_MAX && table->scan_threads > 1 && !small) {
+        num_partitions = scan_partition(
+            &snapshot, range.min_id, range.max_id, table->scan_threads * SCAN_PARTITIONS_PER_THREAD, &partitions);
+    }
+
+    if (num_partitions > 1) {
+        parallel_scan(&snapshot, statement, partitions, num_partitions, output);
+    } else {
+        // seeks straight to the first key in range, only the leaves holding the range are read after the descent
+        Cursor cursor;
+        uint8_t leaf_buffer[PAGE_SIZE];
+
+        snapshot_cursor_seek(&cursor, &snapshot, range.min_id, leaf_buffer);
+        scan_rows(&cursor, statement, range.max_id, range.limit, output);
+    }
+
+    free(partitions);
+    snapshot_close(&snapshot);
+
+    return EXEC_RES_SUCCESS;
+}
+
+// `where name = S` and `where email = S`. An index on the column leads to the ids holding the value, every one of them
+// is then looked up on its own. Without one the whole table is scanned
+void
+select_by_column(Snapshot* snapshot, Statement* statement, FILE* output) {
+    SelectRange* range = &(statement->range);
+    Index* index = snapshot_index(snapshot, statement->column);
+    const uint8_t* value = (const uint8_t*) statement->value;
+    uint32_t length = strlen(statement->value);
+    uint64_t num_matches = 0;
+    uint64_t num_rows = 0;
+    uint8_t leaf_buffer[PAGE_SIZE];
+
+    if (index != NULL) {
+        uint32_t* ids = NULL;
+        uint32_t num_ids = index_lookup(snapshot, index, value, length, &ids);
+
+        num_matches = num_ids;
+
+        // a count only needs the ids
+        for (uint32_t i = range->offset; statement->kind == SELECT_ROWS && i < num_ids && num_rows < range->limit;
+             i++) {
+            Cursor cursor;
+
+            snapshot_cursor_seek(&cursor, snapshot, ids[i], leaf_buffer);
+
+            if (!(cursor.end_of_table) && *leaf_node_key(cursor.node, cursor.cell_num) == ids[i]) {
+                output_row(output, statement, cursor_value(&cursor));
+                num_rows++;
+            }
+        }
+
+        free(ids);
+    } else {
+        Cursor cursor;
+
+        snapshot_cursor_seek(&cursor, snapshot, 0, leaf_buffer);
+
+        while (!(cursor.end_of_table) && (statement->kind == SELECT_COUNT || num_rows < range->limit)) {
+            void* payload = cursor_value(&cursor);
+            uint32_t column_length;
+            const uint8_t* column = row_payload_column(payload, statement->column, &column_length);
+
+            if (column_length == length && memcmp(column, value, length) == 0) {
+                if (statement->kind == SELECT_ROWS && num_matches >= range->offset) {
+                    output_row(output, statement, payload);
+                    num_rows++;
+                }
+
+                num_matches++;
+            }
+
+            cursor_advance(&cursor);
+        }
+    }
+
+    if (statement->kind == SELECT_COUNT) {
+        uint64_t answer = num_matches > range->offset ? num_matches - range->offset : 0;
+
+        answer = answer < range->limit ? answer : range->limit;
+
+        if (statement->format == ROW_FORMAT_BINARY) {
+            fwrite(&answer, sizeof(uint64_t), 1, output);
+        } else {
+            fprintf(output, "-- %lu\n", answer);
+        }
+    }
+}
+
+void
+output_row(FILE* output, Statement* statement, void* payload) {
+    Row row;
+
+    if (statement->format == ROW_FORMAT_BINARY) {
+        fwrite(payload, row_payload_size(payload), 1, output);
+    } else {
+        row_deserialize(payload, &row);
+        show_row(output, &row);
+    }
+}
+
+// writes the rows from the cursor on up to max_id, at most `limit` of them
+void
+scan_rows(Cursor* cursor, Statement* statement, uint32_t max_id, uint32_t limit, FILE* output) {
+    uint32_t num_rows = 0;
+
+    while (!(cursor->end_of_table) && num_rows < limit) {
+        void* payload = cursor_value(cursor);
+        uint32_t id;
+
+        memcpy(&id, payload, SCHEMA_ID_SIZE);
+
+        if (id > max_id) {
+            break;
+        }
+
+        output_row(output, statement, payload);
+        num_rows += 1;
+        cursor_advance(cursor);
+    }
+}
+
+// splits [min_id, max_id] at the keys of the root, and of the level below when the root has fewer children than
+// `max_partitions` in range, so every partition spans whole subtrees. Neighbouring subtrees are grouped to get at most
+// `max_partitions` of them. Returns how many partitions were made, a range within a single child of the root isn't
+// split and comes back as one partition with `partitions` left NULL, for the caller to scan on its own
+uint32_t
+scan_partition(
+    Snapshot* snapshot, uint32_t min_id, uint32_t max_id, uint32_t max_partitions, ScanPartition** partitions) {
+    uint8_t root_buffer[PAGE_SIZE];
+    uint8_t child_buffer[PAGE_SIZE];
+    void* root = snapshot_read_page(snapshot, snapshot->table->root_page_num, root_buffer);
+
+    *partitions = NULL;
+
+    if (get_node_type(root) != NODE_INTERNAL || min_id >= max_id) {
+        return 1;
+    }
+
+    uint32_t first = internal_node_find_child(root, min_id);
+    uint32_t last = internal_node_find_child(root, max_id);
+
+    if (first == last) {
+        return 1;
+    }
+
+    uint32_t num_keys = *internal_node_num_keys(root);
+    bool deeper = last - first + 1 < max_partitions;
+    // keys the partitions end at, min_id <= key < max_id
+    uint32_t num_separators = 0;
+    uint32_t* separators = malloc((last - first + 1) * (INTERNAL_NODE_MAX_KEYS + 2) * sizeof(uint32_t));
+
+    for (uint32_t child_num = first; child_num <= last; child_num++) {
+        void* child = NULL;
+
+        if (deeper) {
+            child = snapshot_read_page(snapshot, *internal_node_child(root, child_num), child_buffer);
+        }
+
+        if (child != NULL && get_node_type(child) == NODE_INTERNAL) {
+            for (uint32_t i = 0; i < *internal_node_num_keys(child); i++) {
+                uint32_t key = *internal_node_key(child, i);
+
+                if (key >= min_id && key < max_id) {
+                    separators[num_separators++] = key;
+                }
+            }
+        }
+
+        if (child_num < num_keys && *internal_node_key(root, child_num) < max_id) {
+            separators[num_separators++] = *internal_node_key(root, child_num);
+        }
+    }
+
+    uint32_t step = num_separators / max_partitions + 1;
+    uint32_t num_partitions = 0;
+    uint32_t partition_min_id = min_id;
+
+    *partitions = malloc((num_separators / step + 1) * sizeof(ScanPartition));
+
+    for (uint32_t i = step - 1; i < num_separators; i += step) {
+        (*partitions)[num_partitions].min_id = partition_min_id;
+        (*partitions)[num_partitions].max_id = separators[i];
+        partition_min_id = separators[i] + 1;
+        num_partitions++;
+    }
+
+    (*partitions)[num_partitions].min_id = partition_min_id;
+    (*partitions)[num_partitions].max_id = max_id;
+    num_partitions++;
+
+    free(separators);
+
+    return num_partitions;
+}
+
+void*
+scan_worker_main(void* arg) {
+    ParallelScan* scan = arg;
+
+    while (true) {
+        pthread_mutex_lock(&(scan->lock));
+        uint32_t index = scan->next_partition++;
+        pthread_mutex_unlock(&(scan->lock));
+
+        if (index >= scan->num_partitions) {
+            return NULL;
+        }
+
+        ScanPartition* partition = &(scan->partitions[index]);
+        FILE* output = open_memstream(&(partition->output), &(partition->output_length));
+        Cursor* cursor = snapshot_seek(scan->snapshot, partition->min_id);
+
+        scan_rows(cursor, scan->statement, partition->max_id, UINT32_MAX, output);
+        cursor_close(cursor);
+        fclose(output);
+
+        pthread_mutex_lock(&(scan->lock));
+        partition->done = true;
+        pthread_cond_broadcast(&(scan->partition_done));
+        pthread_mutex_unlock(&(scan->lock));
+    }
+}
+
+// scans the partitions on up to Table.scan_threads threads. The rows of every partition pile up in a buffer of its own
+// and are written out in key order as soon as the partitions before it are done. The threads that started take the
+// partitions of the ones that couldn't
+void
+parallel_scan(Snapshot* snapshot, Statement* statement, ScanPartition* partitions, uint32_t num_partitions,
+              FILE* output) {
+    ParallelScan scan = {
+        .snapshot = snapshot,
+        .statement = statement,
+        .partitions = partitions,
+        .num_partitions = num_partitions,
+        .next_partition = 0,
+    };
+    uint32_t num_threads = snapshot->table->scan_threads;
+
+    if (num_threads > num_partitions) {
+        num_threads = num_partitions;
+    }
+
+    pthread_t threads[num_threads];
+
+    pthread_mutex_init(&(scan.lock), NULL);
+    pthread_cond_init(&(scan.partition_done), NULL);
+
+    for (uint32_t i = 0; i < num_partitions; i++) {
+        partitions[i].done = false;
+    }
+
+    uint32_t num_started = 0;
+
+    while (num_started < num_threads && pthread_create(&(threads[num_started]), NULL, scan_worker_main, &scan) == 0) {
+        num_started += 1;
+    }
+
+    if (num_started == 0) {
+        // NOTE: no thread could be started, this one takes every partition itself before writing them out
+        scan_worker_main(&scan);
+    }
+
+    for (uint32_t i = 0; i < num_partitions; i++) {
+        pthread_mutex_lock(&(scan.lock));
+
+        while (!(partitions[i].done)) {
+            pthread_cond_wait(&(scan.partition_done), &(scan.lock));
+        }
+
+        pthread_mutex_unlock(&(scan.lock));
+
+        fwrite(partitions[i].output, partitions[i].output_length, 1, output);
+        free(partitions[i].output);
+    }
+
+    for (uint32_t i = 0; i < num_started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&(scan.partition_done));
+    pthread_mutex_destroy(&(scan.lock));
+}
+
+// the rows a select returns are written to `output`
+ExecuteResult
+exec_statement(Statement* statement, Table* table, FILE* output) {
+    uint64_t started_ns = stats_now_ns();
+    ExecuteResult result = EXEC_RES_SUCCESS;
+
+    switch (statement->type) {
+        case (STMT_INSERT):
+            result = exec_stmt_insert(statement, table);
+            latency_record(&(table->insert_latency), started_ns);
+            break;
+        case (STMT_SELECT):
+            result = exec_stmt_select(statement, table, output);
+            latency_record(&(table->select_latency), started_ns);
+            break;
+    }
+
+    return result;
+}
+
+void
+row_serialize(Row* source, void* destination) {
+    uint8_t name_length = strlen(source->name);
+    uint8_t email_length = strlen(source->email);
+
+    memcpy(destination, &(source->id), SCHEMA_ID_SIZE);
+    destination += SCHEMA_ID_SIZE;
+    *((uint8_t*) destination) = name_length;
+    memcpy(destination + SCHEMA_LENGTH_PREFIX_SIZE, source->name, name_length);
+    destination += SCHEMA_LENGTH_PREFIX_SIZE + name_length;
+    *((uint8_t*) destination) = email_length;
+    memcpy(destination + SCHEMA_LENGTH_PREFIX_SIZE, source->email, email_length);
+}
+
+void
+row_deserialize(void* source, Row* destination) {
+    memcpy(&(destination->id), source, SCHEMA_ID_SIZE);
+    source += SCHEMA_ID_SIZE;
+
+    uint8_t name_length = *((uint8_t*) source);
+
+    memcpy(destination->name, source + SCHEMA_LENGTH_PREFIX_SIZE, name_length);
+    destination->name[name_length] = '\0';
+    source += SCHEMA_LENGTH_PREFIX_SIZE + name_length;
+
+    uint8_t email_length = *((uint8_t*) source);
+
+    memcpy(destination->email, source + SCHEMA_LENGTH_PREFIX_SIZE, email_length);
+    destination->email[email_length] = '\0';
+}
+
+uint32_t
+row_serialized_size(Row* row) {
+    return ROW_MIN_SIZE + strlen(row->name) + strlen(row->email);
+}
+
+// size of a stored row, read from its length prefixes
+uint32_t
+row_payload_size(void* payload) {
+    uint8_t name_length = *((uint8_t*) (payload + SCHEMA_ID_SIZE));
+    uint8_t email_length = *((uint8_t*) (payload + SCHEMA_ID_SIZE + SCHEMA_LENGTH_PREFIX_SIZE + name_length));
+
+    return ROW_MIN_SIZE + name_length + email_length;
+}
+
+// whether `size` bytes received from a client are exactly one row encoded the way it's stored
+bool
+row_payload_valid(const void* payload, uint32_t size) {
+    if (size < ROW_MIN_SIZE) {
+        return false;
+    }
+
+    uint8_t name_length = *((const uint8_t*) (payload + SCHEMA_ID_SIZE));
+
+    if (name_length > NAME_SIZE || ROW_MIN_SIZE + name_length > size) {
+        return false;
+    }
+
+    // NOTE: an email can't be longer than EMAIL_SIZE, the largest length a byte holds
+    uint8_t email_length = *((const uint8_t*) (payload + SCHEMA_ID_SIZE + SCHEMA_LENGTH_PREFIX_SIZE + name_length));
+
+    if (ROW_MIN_SIZE + name_length + email_length != size) {
+        return false;
+    }
+
+    // a line of the text protocol can't hold control bytes, the binary one mustn't store them either: a `\n` or a
+    // `\0` would break the rows `select` prints and the lines `.export` writes
+    const uint8_t* name = payload + SCHEMA_ID_SIZE + SCHEMA_LENGTH_PREFIX_SIZE;
+    const uint8_t* email = name + name_length + SCHEMA_LENGTH_PREFIX_SIZE;
+
+    for (uint32_t i = 0; i < name_length; i++) {
+        if (name[i] < ' ' || name[i] == 0x7f) {
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < email_length; i++) {
+        if (email[i] < ' ' || email[i] == 0x7f) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// the bytes of a string column of a stored row, they aren't '\0' terminated
+const uint8_t*
+row_payload_column(const void* payload, Column column, uint32_t* length) {
+    const uint8_t* value = payload + SCHEMA_ID_SIZE;
+
+    if (column == COLUMN_EMAIL) {
+        value += SCHEMA_LENGTH_PREFIX_SIZE + value[0];
+    }
+
+    *length = value[0];
+
+    return value + SCHEMA_LENGTH_PREFIX_SIZE;
+}
+
+// NOTE: the value lives in the leaf latched by the cursor, it's only valid until the cursor moves to another leaf
+void*
+cursor_value(Cursor* cursor) {
+    return leaf_node_value(cursor->node, cursor->cell_num);
+}
+
+void
+show_row(FILE* output, Row* row) {
+    fprintf(output, "-- %d %s %s\n", row->id, row->name, row->email);
+}
+
+uint32_t
+pager_hash(Pager* pager, uint32_t page_num) {
+    // NOTE: fibonacci hashing, spreads sequential page numbers across the buckets
+    return (page_num * 2654435769u) & pager->bucket_mask;
+}
+
+uint32_t
+pager_lookup(Pager* pager, uint32_t page_num) {
+    uint32_t frame_idx = pager->buckets[pager_hash(pager, page_num)];
+
+    while (frame_idx != INVALID_FRAME && pager->frames[frame_idx].page_num != page_num) {
+        frame_idx = pager->frames[frame_idx].hash_next;
+    }
+
+    return frame_idx;
+}
+
+void
+pager_unlink(Pager* pager, uint32_t frame_idx) {
+    uint32_t* link = &(pager->buckets[pager_hash(pager, pager->frames[frame_idx].page_num)]);
+
+    while (*link != frame_idx) {
+        link = &(pager->frames[*link].hash_next);
+    }
+
+    *link = pager->frames[frame_idx].hash_next;
+}
+
+// NOTE: needs no lock, the caller keeps the page from changing until it's written
+void
+pager_write_page(Pager* pager, uint32_t page_num, const void* data) {
+    // write-ahead rule, the log records describing the page must be durable before the page itself
+    if (pager->wal != NULL) {
+        wal_flush(pager->wal);
+    }
+
+    if (pwrite(pager->fd, data, PAGE_SIZE, (off_t) page_num * PAGE_SIZE) == -1) {
+        printf("error writing: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void
+pager_count_write(Pager* pager, uint32_t page_num) {
+    off_t end = (off_t) (page_num + 1) * PAGE_SIZE;
+
+    pager->pages_written += 1;
+
+    if (end > pager->file_length) {
+        pager->file_length = end;
+    }
+}
+
+void
+pager_write_frame(Pager* pager, Frame* frame) {
+    pager_write_page(pager, frame->page_num, frame->data);
+    pager_count_write(pager, frame->page_num);
+}
+
+// waits for the read or write back of a frame the caller pinned, the pool lock is let go of meanwhile
+void
+pager_wait_io(Pager* pager, Frame* frame) {
+    while (frame->io_pending) {
+        pthread_cond_wait(&(frame->io_done), &(pager->lock));
+    }
+}
+
+// CLOCK replacement: sweep the frames giving a second chance to the recently referenced ones, pinned frames are
+// skipped. The victim is written back before the frame is handed out, without the pool lock
+uint32_t
+pager_claim_frame(Pager* pager) {
+    if (pager->num_used_frames < pager->num_frames) {
+        return pager->num_used_frames++;
+    }
+
+    for (uint32_t sweep = 0; sweep < 2 * pager->num_frames; sweep++) {
+        uint32_t frame_idx = pager->clock_hand;
+        Frame* frame = &(pager->frames[frame_idx]);
+
+        pager->clock_hand = (pager->clock_hand + 1) % pager->num_frames;
+
+        if (frame->pin_count > 0) {
+            continue;
+        }
+
+        if (frame->referenced) {
+            frame->referenced = false;
+            continue;
+        }
+
+        if (frame->dirty) {
+            // NOTE: the victim stays in the page table and pinned while it's written, a thread wanting the page
+            // waits on the frame and the page then stays cached
+            frame->dirty = false;
+            frame->pin_count = 1;
+            frame->io_pending = true;
+            pager->num_dirty -= 1;
+            pthread_mutex_unlock(&(pager->lock));
+
+            pager_write_page(pager, frame->page_num, frame->data);
+
+            pthread_mutex_lock(&(pager->lock));
+            pager_count_write(pager, frame->page_num);
+            frame->io_pending = false;
+            frame->pin_count -= 1;
+            pthread_cond_broadcast(&(frame->io_done));
+
+            if (frame->pin_count > 0) {
+                continue;
+            }
+        }
+
+        // NOTE: a frame claimed for a page someone else loaded meanwhile is left free, it's in no chain
+        if (frame->page_num != INVALID_PAGE_NUM) {
+            pager_unlink(pager, frame_idx);
+            frame->page_num = INVALID_PAGE_NUM;
+            pager->pages_evicted += 1;
+        }
+
+        return frame_idx;
+    }
+
+    printf("buffer pool exhausted, all %d frames are pinned\n", pager->num_frames);
+    exit(EXIT_FAILURE);
+}
+
+// grows the file and the mapping, in PAGER_MMAP_EXTENT steps, until it covers `length` bytes
+void
+pager_mmap_grow(Pager* pager, off_t length) {
+    off_t new_length = ((length + PAGER_MMAP_EXTENT - 1) / PAGER_MMAP_EXTENT) * PAGER_MMAP_EXTENT;
+
+    if ((unsigned long long) new_length > PAGER_MMAP_RESERVE) {
+        printf("database outgrew the mmap reservation of %llu bytes\n", PAGER_MMAP_RESERVE);
+        exit(EXIT_FAILURE);
+    }
+
+    if (new_length > pager->file_length && ftruncate(pager->fd, new_length) == -1) {
+        printf("error growing file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    void* extent = mmap(pager->map + pager->map_length,
+                        new_length - pager->map_length,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_FIXED,
+                        pager->fd,
+                        pager->map_length);
+
+    if (extent == MAP_FAILED) {
+        printf("error mapping file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    if (new_length > pager->file_length) {
+        pager->file_length = new_length;
+    }
+
+    size_t old_words = (pager->map_length / PAGE_SIZE + 63) / 64;
+    size_t new_words = (new_length / PAGE_SIZE + 63) / 64;
+
+    pager->dirty_bitmap = realloc(pager->dirty_bitmap, new_words * sizeof(uint64_t));
+    memset(pager->dirty_bitmap + old_words, 0, (new_words - old_words) * sizeof(uint64_t));
+
+    for (off_t extent_offset = pager->map_length; extent_offset < new_length; extent_offset += PAGER_MMAP_EXTENT) {
+        pthread_rwlock_t* latches = malloc(PAGER_MMAP_EXTENT_PAGES * sizeof(pthread_rwlock_t));
+
+        for (uint32_t i = 0; i < PAGER_MMAP_EXTENT_PAGES; i++) {
+            pager_latch_init(&(latches[i]));
+        }
+
+        pager->latch_extents[extent_offset / PAGER_MMAP_EXTENT] = latches;
+    }
+
+    pager->map_length = new_length;
+}
+
+// cache miss, the page goes in the page table pinned before it's read so no one else loads it into another frame
+void*
+pager_load_frame(Pager* pager, uint32_t frame_idx, uint32_t page_num) {
+    Frame* frame = &(pager->frames[frame_idx]);
+    uint32_t num_pages = pager->file_length / PAGE_SIZE;
+    uint32_t bucket = pager_hash(pager, page_num);
+
+    // we might save a partial page at the end of the file
+    if (pager->file_length % PAGE_SIZE) {
+        num_pages += 1;
+    }
+
+    frame->page_num = page_num;
+    frame->pin_count = 1;
+    frame->referenced = true;
+    frame->dirty = false;
+    frame->hash_next = pager->buckets[bucket];
+    pager->buckets[bucket] = frame_idx;
+
+    if (page_num >= pager->num_pages) {
+        pager->num_pages = page_num + 1;
+    }
+
+    if (page_num >= num_pages) {
+        memset(frame->data, 0, PAGE_SIZE);
+        return frame->data;
+    }
+
+    // the other threads go on with the pool meanwhile, the ones wanting this page wait on the frame
+    frame->io_pending = true;
+    pthread_mutex_unlock(&(pager->lock));
+
+    ssize_t bytes_read = pread(pager->fd, frame->data, PAGE_SIZE, (off_t) page_num * PAGE_SIZE);
+
+    if (bytes_read == -1) {
+        printf("error reading file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    memset(frame->data + bytes_read, 0, PAGE_SIZE - bytes_read);
+
+    pthread_mutex_lock(&(pager->lock));
+    pager->pages_read += 1;
+    frame->io_pending = false;
+    pthread_cond_broadcast(&(frame->io_done));
+
+    return frame->data;
+}
+
+// NOTE: a miss lets go of the pool lock while the page is read in, and so may claiming a frame. A page the caller
+// already pinned is never read in, the lock is kept throughout
+void*
+get_page_locked(Pager* pager, uint32_t page_num) {
+    if (page_num == INVALID_PAGE_NUM) {
+        printf("tried to fetch an invalid page number\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pager->mode == PAGER_MMAP) {
+        off_t offset = (off_t) page_num * PAGE_SIZE;
+
+        if (offset + PAGE_SIZE > pager->map_length) {
+            pager_mmap_grow(pager, offset + PAGE_SIZE);
+        }
+
+        if (page_num >= pager->num_pages) {
+            pager->num_pages = page_num + 1;
+        }
+
+        return pager->map + offset;
+    }
+
+    uint32_t frame_idx = pager_lookup(pager, page_num);
+
+    if (frame_idx == INVALID_FRAME) {
+        pager->cache_misses += 1;
+        frame_idx = pager_claim_frame(pager);
+
+        // another thread may have loaded the page while the lock was let go of
+        if (pager_lookup(pager, page_num) == INVALID_FRAME) {
+            return pager_load_frame(pager, frame_idx, page_num);
+        }
+
+        pager->frames[frame_idx].referenced = false;
+        frame_idx = pager_lookup(pager, page_num);
+    } else {
+        pager->cache_hits += 1;
+    }
+
+    Frame* frame = &(pager->frames[frame_idx]);
+
+    frame->pin_count += 1;
+    frame->referenced = true;
+    pager_wait_io(pager, frame);
+
+    return frame->data;
+}
+
+// NOTE: the returned page is pinned and stays in memory until the matching unpin_page call
+void*
+get_page(Pager* pager, uint32_t page_num) {
+    pthread_mutex_lock(&(pager->lock));
+
+    void* page = get_page_locked(pager, page_num);
+
+    pthread_mutex_unlock(&(pager->lock));
+
+    return page;
+}
+
+void
+unpin_page_locked(Pager* pager, uint32_t page_num) {
+    if (pager->mode == PAGER_MMAP) {
+        return;
+    }
+
+    uint32_t frame_idx = pager_lookup(pager, page_num);
+
+    if (frame_idx == INVALID_FRAME || pager->frames[frame_idx].pin_count == 0) {
+        printf("tried to unpin page %d that is not pinned\n", page_num);
+        exit(EXIT_FAILURE);
+    }
+
+    pager->frames[frame_idx].pin_count -= 1;
+}
+
+void
+unpin_page(Pager* pager, uint32_t page_num) {
+    pthread_mutex_lock(&(pager->lock));
+    unpin_page_locked(pager, page_num);
+    pthread_mutex_unlock(&(pager->lock));
+}
+
+// readers queue behind a waiting writer, otherwise a steady stream of them would keep the writer off the upper levels
+// of the tree
+void
+pager_latch_init(pthread_rwlock_t* latch) {
+    pthread_rwlockattr_t attr;
+
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(latch, &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+
+// the latch of a page pinned by the caller
+pthread_rwlock_t*
+pager_page_latch(Pager* pager, void* page) {
+    if (pager->mode == PAGER_MMAP) {
+        uint32_t page_num = (page - pager->map) / PAGE_SIZE;
+
+        return &(pager->latch_extents[page_num / PAGER_MMAP_EXTENT_PAGES][page_num % PAGER_MMAP_EXTENT_PAGES]);
+    }
+
+    return &(pager->frames[(page - pager->frame_memory) / PAGE_SIZE].latch);
+}
+
+// pins the page and latches it, the page can't be changed by anyone else until the matching pager_unlatch
+// NOTE: latches are taken top-down along the tree and left to right along the leaf chain, never the other way around,
+// so latching threads never wait on each other in a cycle
+void*
+pager_latch(Pager* pager, uint32_t page_num, LatchMode mode) {
+    void* page = get_page(pager, page_num);
+    pthread_rwlock_t* latch = pager_page_latch(pager, page);
+
+    if (mode == LATCH_SHARED) {
+        pthread_rwlock_rdlock(latch);
+    } else {
+        pthread_rwlock_wrlock(latch);
+    }
+
+    return page;
+}
+
+void
+pager_unlatch(Pager* pager, uint32_t page_num) {
+    void* page;
+
+    if (pager->mode == PAGER_MMAP) {
+        page = pager->map + (off_t) page_num * PAGE_SIZE;
+    } else {
+        pthread_mutex_lock(&(pager->lock));
+        page = pager->frames[pager_lookup(pager, page_num)].data;
+        pthread_mutex_unlock(&(pager->lock));
+    }
+
+    // the latch is dropped before the pin, the frame can't be handed to another page while it's still held
+    pthread_rwlock_unlock(pager_page_latch(pager, page));
+    unpin_page(pager, page_num);
+}
+
+// remembers what the page looked like before the running transaction changed it and keeps it pinned until commit
+void
+pager_txn_track(Pager* pager, uint32_t page_num) {
+    for (uint32_t i = 0; i < pager->txn_num_pages; i++) {
+        if (pager->txn_page_nums[i] == page_num) {
+            return;
+        }
+    }
+
+    if (pager->txn_num_pages == pager->txn_capacity) {
+        uint32_t capacity = pager->txn_capacity == 0 ? 8 : pager->txn_capacity * 2;
+
+        pager->txn_page_nums = realloc(pager->txn_page_nums, capacity * sizeof(uint32_t));
+        pager->txn_pages = realloc(pager->txn_pages, capacity * sizeof(void*));
+        pager->txn_pre_images = realloc(pager->txn_pre_images, capacity * sizeof(void*));
+
+        // NOTE: pre-image buffers are kept between transactions, they're only allocated when a transaction touches
+        // more pages than any before it
+        for (uint32_t i = pager->txn_capacity; i < capacity; i++) {
+            pager->txn_pre_images[i] = malloc(PAGE_SIZE);
+        }
+
+        pager->txn_capacity = capacity;
+    }
+
+    void* page = get_page_locked(pager, page_num);  // the extra pin is released by pager_commit
+    uint32_t slot = pager->txn_num_pages++;
+
+    pager->txn_page_nums[slot] = page_num;
+    pager->txn_pages[slot] = page;
+    memcpy(pager->txn_pre_images[slot], page, PAGE_SIZE);
+}
+
+void
+pager_mark_dirty_locked(Pager* pager, uint32_t page_num) {
+    if (pager->snapshots != NULL) {
+        pager_save_version(pager, page_num, NULL);
+    }
+
+    if (pager->txn_active) {
+        pager_txn_track(pager, page_num);
+    }
+
+    if (pager->mode == PAGER_MMAP) {
+        uint64_t bit = 1ULL << (page_num % 64);
+
+        if (!(pager->dirty_bitmap[page_num / 64] & bit)) {
+            pager->dirty_bitmap[page_num / 64] |= bit;
+            pager->num_dirty += 1;
+        }
+
+        return;
+    }
+
+    uint32_t frame_idx = pager_lookup(pager, page_num);
+
+    if (frame_idx == INVALID_FRAME || pager->frames[frame_idx].pin_count == 0) {
+        printf("tried to mark page %d dirty without pinning it\n", page_num);
+        exit(EXIT_FAILURE);
+    }
+
+    if (!pager->frames[frame_idx].dirty) {
+        pager->frames[frame_idx].dirty = true;
+        pager->num_dirty += 1;
+    }
+}
+
+// NOTE: must be called on a pinned page before it is changed, so the write back knows about it
+void
+pager_mark_dirty(Pager* pager, uint32_t page_num) {
+    pthread_mutex_lock(&(pager->lock));
+    pager_mark_dirty_locked(pager, page_num);
+    pthread_mutex_unlock(&(pager->lock));
+}
+
+int
+compare_frame_page_num(const void* a, const void* b, void* frames) {
+    uint32_t page_a = ((Frame*) frames)[*(const uint32_t*) a].page_num;
+    uint32_t page_b = ((Frame*) frames)[*(const uint32_t*) b].page_num;
+
+    return (page_a > page_b) - (page_a < page_b);
+}
+
+// writes `count` frames holding consecutive pages, starting at `first_page_num`, with as few pwritev calls as possible
+void
+pager_write_run(Pager* pager, uint32_t first_page_num, uint32_t* frame_idxs, uint32_t count) {
+    struct iovec iov[IOV_MAX];
+
+    while (count > 0) {
+        int iov_count = count < IOV_MAX ? count : IOV_MAX;
+        off_t offset = (off_t) first_page_num * PAGE_SIZE;
+        ssize_t remaining = (ssize_t) iov_count * PAGE_SIZE;
+
+        for (int i = 0; i < iov_count; i++) {
+            iov[i].iov_base = pager->frames[frame_idxs[i]].data;
+            iov[i].iov_len = PAGE_SIZE;
+        }
+
+        struct iovec* next = iov;
+        int next_count = iov_count;
+
+        while (remaining > 0) {
+            ssize_t bytes_written = pwritev(pager->fd, next, next_count, offset);
+
+            if (bytes_written == -1) {
+                printf("error writing: %d\n", errno);
+                exit(EXIT_FAILURE);
+            }
+
+            // short write, skip what already landed and retry with the rest
+            offset += bytes_written;
+            remaining -= bytes_written;
+
+            while (next_count > 0 && (size_t) bytes_written >= next->iov_len) {
+                bytes_written -= next->iov_len;
+                next++;
+                next_count--;
+            }
+
+            if (next_count > 0) {
+                next->iov_base += bytes_written;
+                next->iov_len -= bytes_written;
+            }
+        }
+
+        pager->pages_written += iov_count;
+
+        if (offset > pager->file_length) {
+            pager->file_length = offset;
+        }
+
+        first_page_num += iov_count;
+        frame_idxs += iov_count;
+        count -= iov_count;
+    }
+}
+
+// writes back every dirty page, runs of adjacent pages go out as a single vectored write (msync'd range on mmap)
+void
+pager_flush_dirty_locked(Pager* pager) {
+    if (pager->num_dirty == 0) {
+        return;
+    }
+
+    if (pager->wal != NULL) {
+        wal_flush(pager->wal);
+    }
+
+    if (pager->mode == PAGER_MMAP) {
+        uint32_t page_num = 0;
+
+        while (page_num < pager->num_pages) {
+            if (!(pager->dirty_bitmap[page_num / 64] & (1ULL << (page_num % 64)))) {
+                page_num++;
+                continue;
+            }
+
+            uint32_t first_page_num = page_num;
+
+            while (page_num < pager->num_pages && (pager->dirty_bitmap[page_num / 64] & (1ULL << (page_num % 64)))) {
+                pager->dirty_bitmap[page_num / 64] &= ~(1ULL << (page_num % 64));
+                page_num++;
+            }
+
+            void* start = pager->map + (off_t) first_page_num * PAGE_SIZE;
+
+            if (msync(start, (size_t) (page_num - first_page_num) * PAGE_SIZE, MS_SYNC) == -1) {
+                printf("error syncing db file: %d\n", errno);
+                exit(EXIT_FAILURE);
+            }
+
+            pager->pages_written += page_num - first_page_num;
+        }
+
+        pager->num_dirty = 0;
+
+        return;
+    }
+
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < pager->num_used_frames; i++) {
+        if (pager->frames[i].dirty) {
+            pager->flush_list[count++] = i;
+        }
+    }
+
+    qsort_r(pager->flush_list, count, sizeof(uint32_t), compare_frame_page_num, pager->frames);
+
+    uint32_t run_start = 0;
+
+    for (uint32_t i = 1; i <= count; i++) {
+        if (i < count
+            && pager->frames[pager->flush_list[i]].page_num == pager->frames[pager->flush_list[i - 1]].page_num + 1) {
+            continue;
+        }
+
+        pager_write_run(
+            pager, pager->frames[pager->flush_list[run_start]].page_num, pager->flush_list + run_start, i - run_start);
+        run_start = i;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        pager->frames[pager->flush_list[i]].dirty = false;
+    }
+
+    pager->num_dirty = 0;
+}
+
+// NOTE: only the writer dirties pages and it flushes them between statements, so no page changes while it's written
+void
+pager_flush_dirty(Pager* pager) {
+    pthread_mutex_lock(&(pager->lock));
+    pager_flush_dirty_locked(pager);
+    pthread_mutex_unlock(&(pager->lock));
+}
+
+// threshold triggered writer, keeps the amount of unwritten changes bounded between statements
+void
+pager_maybe_flush(Pager* pager) {
+    pthread_mutex_lock(&(pager->lock));
+
+    if (pager->num_dirty >= pager->flush_threshold) {
+        pager_flush_dirty_locked(pager);
+    }
+
+    pthread_mutex_unlock(&(pager->lock));
+}
+
+// one region holding every frame of the buffer pool, in whole huge pages so the cache sits behind a handful of TLB
+// entries. Huge pages reserved on the system are taken when there are enough of them, otherwise the region is aligned
+// to a huge page by hand and left to transparent huge pages. NULL when not even plain pages are left
+void*
+pager_frame_arena(uint32_t num_frames, size_t* length) {
+    *length = ((size_t) num_frames * PAGE_SIZE + PAGER_HUGE_PAGE_SIZE - 1) & ~((size_t) PAGER_HUGE_PAGE_SIZE - 1);
+
+    int prot = PROT_READ | PROT_WRITE;
+    void* arena = mmap(NULL, *length, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+    if (arena != MAP_FAILED) {
+        return arena;
+    }
+
+    // NOTE: a huge page more is mapped so an aligned start can be picked, the ends left over are handed back
+    uint8_t* region = mmap(NULL, *length + PAGER_HUGE_PAGE_SIZE, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (region == MAP_FAILED) {
+        return NULL;
+    }
+
+    uintptr_t mask = PAGER_HUGE_PAGE_SIZE - 1;
+    uint8_t* start = (uint8_t*) (((uintptr_t) region + mask) & ~mask);
+    uint8_t* end = start + *length;
+    uint8_t* region_end = region + *length + PAGER_HUGE_PAGE_SIZE;
+
+    if (start > region) {
+        munmap(region, start - region);
+    }
+
+    if (end < region_end) {
+        munmap(end, region_end - end);
+    }
+
+    madvise(start, *length, MADV_HUGEPAGE);
+
+    return start;
+}
+
+// the alignment direct I/O on the file asks of the buffers and of the file offsets, the larger of the two. Kernels
+// that can't tell get the 512 bytes of a logical block, the smallest any device has
+uint32_t
+pager_direct_alignment(int fd) {
+    uint32_t alignment = 512;
+
+#ifdef STATX_DIOALIGN
+    struct statx stx;
+
+    if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 && (stx.stx_mask & STATX_DIOALIGN)) {
+        alignment = stx.stx_dio_mem_align > stx.stx_dio_offset_align ? stx.stx_dio_mem_align : stx.stx_dio_offset_align;
+    }
+#endif
+
+    return alignment;
+}
+
+Pager*
+pager_open(const char* filename, PagerMode mode, uint32_t num_frames, uint32_t flush_threshold) {
+    // NOTE: direct I/O skips the page cache, pages are only cached once, in the buffer pool
+    int flags = O_RDWR | O_CREAT | (mode == PAGER_DIRECT ? O_DIRECT : 0);
+    int fd = open(filename, flags, S_IWUSR | S_IRUSR);
+
+    if (fd == -1 && mode == PAGER_DIRECT && errno == EINVAL) {
+        printf("the file system doesn't support direct I/O\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (fd == -1) {
+        printf("unable to open file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // the frames start on huge page boundaries and every read and write covers a whole page at a page offset, so a
+    // page is aligned for any device whose blocks aren't larger than one
+    if (mode == PAGER_DIRECT && pager_direct_alignment(fd) > PAGE_SIZE) {
+        printf("direct I/O on this file needs an alignment of %u bytes, pages are %u\n", pager_direct_alignment(fd),
+               PAGE_SIZE);
+        exit(EXIT_FAILURE);
+    }
+
+    off_t file_length = lseek(fd, 0, SEEK_END);
+
+    Pager* pager = malloc(sizeof(Pager));
+    pager->fd = fd;
+    pager->file_length = file_length;
+    pager->num_pages = (file_length / PAGE_SIZE);
+
+    if (file_length % PAGE_SIZE != 0) {
+        printf("db file is not a whole number of pages. corrupted file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pager->mode = mode;
+    pthread_mutex_init(&(pager->lock), NULL);
+    pager->num_dirty = 0;
+    pager->flush_threshold = flush_threshold;
+    pager->dirty_bitmap = NULL;
+    pager->latch_extents = NULL;
+    pager->flush_list = NULL;
+    pager->wal = NULL;
+    pager->txn_active = false;
+    pager->txn_num_pages = 0;
+    pager->txn_capacity = 0;
+    pager->txn_page_nums = NULL;
+    pager->txn_pages = NULL;
+    pager->txn_pre_images = NULL;
+    pager->commit_seq = 0;
+    pager->pages_read = 0;
+    pager->pages_written = 0;
+    pager->cache_hits = 0;
+    pager->cache_misses = 0;
+    pager->pages_evicted = 0;
+    pager->snapshots = NULL;
+    pager->version_buckets = calloc(PAGER_VERSION_BUCKETS, sizeof(PageVersion*));
+    pager->num_versions = 0;
+    pager->free_versions = NULL;
+
+    if (mode == PAGER_MMAP) {
+        // NOTE: only address space is reserved here, the extents are mapped over it with MAP_FIXED as the file grows
+        pager->map = mmap(NULL, PAGER_MMAP_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+        if (pager->map == MAP_FAILED) {
+            printf("unable to reserve %llu bytes of address space\n", PAGER_MMAP_RESERVE);
+            exit(EXIT_FAILURE);
+        }
+
+        pager->map_length = 0;
+        pager->latch_extents = calloc(PAGER_MMAP_RESERVE / PAGER_MMAP_EXTENT, sizeof(pthread_rwlock_t*));
+        pager->num_frames = 0;
+        pager->num_used_frames = 0;
+        pager->frames = NULL;
+        pager->buckets = NULL;
+        pager->frame_memory = NULL;
+        pager->frame_memory_length = 0;
+
+        if (file_length > 0) {
+            pager_mmap_grow(pager, file_length);
+        }
+
+        return pager;
+    }
+
+    if (num_frames < PAGER_MIN_FRAMES) {
+        printf("buffer pool needs at least %d frames\n", PAGER_MIN_FRAMES);
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t num_buckets = 1;
+
+    while (num_buckets < 2 * num_frames) {
+        num_buckets <<= 1;
+    }
+
+    pager->num_frames = num_frames;
+    pager->num_used_frames = 0;
+    pager->clock_hand = 0;
+    pager->bucket_mask = num_buckets - 1;
+    pager->buckets = malloc(num_buckets * sizeof(uint32_t));
+    pager->frames = malloc(num_frames * sizeof(Frame));
+    pager->frame_memory = pager_frame_arena(num_frames, &(pager->frame_memory_length));
+    pager->flush_list = malloc(num_frames * sizeof(uint32_t));
+
+    if (pager->buckets == NULL || pager->frames == NULL || pager->frame_memory == NULL || pager->flush_list == NULL) {
+        printf("unable to allocate a buffer pool of %d frames\n", num_frames);
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < num_buckets; i++) {
+        pager->buckets[i] = INVALID_FRAME;
+    }
+
+    for (uint32_t i = 0; i < num_frames; i++) {
+        pager->frames[i].data = pager->frame_memory + (size_t) i * PAGE_SIZE;
+        pager->frames[i].page_num = INVALID_PAGE_NUM;
+        pager->frames[i].pin_count = 0;
+        pager->frames[i].hash_next = INVALID_FRAME;
+        pager->frames[i].referenced = false;
+        pager->frames[i].dirty = false;
+        pager->frames[i].io_pending = false;
+        pthread_cond_init(&(pager->frames[i].io_done), NULL);
+        pager_latch_init(&(pager->frames[i].latch));
+    }
+
+    return pager;
+}
+
+void
+pager_flush_locked(Pager* pager, uint32_t page_num) {
+    if (pager->mode == PAGER_MMAP) {
+        uint64_t bit = 1ULL << (page_num % 64);
+
+        if (!(pager->dirty_bitmap[page_num / 64] & bit)) {
+            return;
+        }
+
+        if (msync(pager->map + (off_t) page_num * PAGE_SIZE, PAGE_SIZE, MS_SYNC) == -1) {
+            printf("error syncing page %d: %d\n", page_num, errno);
+            exit(EXIT_FAILURE);
+        }
+
+        pager->dirty_bitmap[page_num / 64] &= ~bit;
+        pager->num_dirty -= 1;
+        pager->pages_written += 1;
+
+        return;
+    }
+
+    uint32_t frame_idx = pager_lookup(pager, page_num);
+
+    if (frame_idx == INVALID_FRAME) {
+        printf("tried to flush a page that is not cached\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Frame* frame = &(pager->frames[frame_idx]);
+
+    if (frame->dirty) {
+        pager_write_frame(pager, frame);
+        frame->dirty = false;
+        pager->num_dirty -= 1;
+    }
+}
+
+void
+pager_flush(Pager* pager, uint32_t page_num) {
+    pthread_mutex_lock(&(pager->lock));
+    pager_flush_locked(pager, page_num);
+    pthread_mutex_unlock(&(pager->lock));
+}
+
+PageVersion**
+pager_version_bucket(Pager* pager, uint32_t page_num) {
+    return &(pager->version_buckets[(page_num * 2654435769u) & (PAGER_VERSION_BUCKETS - 1)]);
+}
+
+// keeps the committed image of a page the writer is about to change, when an open snapshot could still read it.
+// `image` is that image when the page already changed, NULL takes the page as it is
+void
+pager_save_version(Pager* pager, uint32_t page_num, const void* image) {
+    Snapshot* newest = pager->snapshots;
+    PageVersion** bucket = pager_version_bucket(pager, page_num);
+
+    // a page created after the newest snapshot is out of reach of every snapshot
+    if (page_num >= newest->num_pages) {
+        return;
+    }
+
+    for (PageVersion* version = *bucket; version != NULL; version = version->next) {
+        // the latest version is still newer than every snapshot, none of them reads the page itself
+        if (version->page_num == page_num) {
+            if (version->end_seq > newest->seq) {
+                return;
+            }
+
+            break;
+        }
+    }
+
+    // pruned versions are reused, a writer racing long-lived snapshots doesn't go to malloc for every page it changes
+    PageVersion* version = pager->free_versions;
+
+    if (version != NULL) {
+        pager->free_versions = version->next;
+    } else {
+        version = malloc(sizeof(PageVersion));
+        version->data = malloc(PAGE_SIZE);
+    }
+
+    version->page_num = page_num;
+    version->end_seq = pager->commit_seq + 1;
+
+    if (image != NULL) {
+        memcpy(version->data, image, PAGE_SIZE);
+    } else {
+        memcpy(version->data, get_page_locked(pager, page_num), PAGE_SIZE);
+        unpin_page_locked(pager, page_num);
+    }
+
+    version->next = *bucket;
+    *bucket = version;
+    pager->num_versions += 1;
+}
+
+// the image of the page as of commit `seq`, the oldest version replaced after it, NULL when the page didn't change since
+PageVersion*
+pager_find_version(Pager* pager, uint32_t page_num, uint64_t seq) {
+    PageVersion* found = NULL;
+
+    for (PageVersion* version = *pager_version_bucket(pager, page_num); version != NULL; version = version->next) {
+        if (version->page_num == page_num && version->end_seq > seq) {
+            found = version;
+        }
+    }
+
+    return found;
+}
+
+// drops the versions no open snapshot reads anymore, the ones replaced before the oldest snapshot began
+void
+pager_prune_versions(Pager* pager) {
+    uint64_t oldest_seq = UINT64_MAX;
+
+    for (Snapshot* snapshot = pager->snapshots; snapshot != NULL; snapshot = snapshot->next) {
+        if (snapshot->seq < oldest_seq) {
+            oldest_seq = snapshot->seq;
+        }
+    }
+
+    for (uint32_t i = 0; i < PAGER_VERSION_BUCKETS && pager->num_versions > 0; i++) {
+        PageVersion** link = &(pager->version_buckets[i]);
+
+        while (*link != NULL) {
+            PageVersion* version = *link;
+
+            if (pager->snapshots != NULL && version->end_seq > oldest_seq) {
+                link = &(version->next);
+                continue;
+            }
+
+            *link = version->next;
+            version->next = pager->free_versions;
+            pager->free_versions = version;
+            pager->num_versions -= 1;
+        }
+    }
+}
+
+// sees the commits made so far and none of the statement running meanwhile, without waiting for it
+Snapshot*
+snapshot_begin(Table* table) {
+    Snapshot* snapshot = malloc(sizeof(Snapshot));
+
+    snapshot_open(snapshot, table);
+
+    return snapshot;
+}
+
+// snapshot_begin into a snapshot the caller owns, it stays registered with the pager until snapshot_close
+void
+snapshot_open(Snapshot* snapshot, Table* table) {
+    Pager* pager = table->pager;
+
+    // NOTE: the commit sequence moves under the pager lock, so the running transaction is either committed or still
+    // tracking its pages here
+    pthread_mutex_lock(&(pager->lock));
+
+    snapshot->table = table;
+    snapshot->seq = pager->commit_seq;
+    snapshot->num_pages = pager->num_pages;
+    snapshot->prev = NULL;
+    snapshot->next = pager->snapshots;
+
+    if (pager->snapshots != NULL) {
+        pager->snapshots->prev = snapshot;
+    }
+
+    pager->snapshots = snapshot;
+
+    // the pages the running statement already changed are read as they were before it, the ones it changes from now
+    // on get a version when they're marked dirty
+    if (pager->txn_active) {
+        for (uint32_t i = 0; i < pager->txn_num_pages; i++) {
+            pager_save_version(pager, pager->txn_page_nums[i], pager->txn_pre_images[i]);
+        }
+    }
+
+    pthread_mutex_unlock(&(pager->lock));
+}
+
+void
+snapshot_end(Snapshot* snapshot) {
+    snapshot_close(snapshot);
+    free(snapshot);
+}
+
+void
+snapshot_close(Snapshot* snapshot) {
+    Pager* pager = snapshot->table->pager;
+
+    pthread_mutex_lock(&(pager->lock));
+
+    if (snapshot->prev != NULL) {
+        snapshot->prev->next = snapshot->next;
+    } else {
+        pager->snapshots = snapshot->next;
+    }
+
+    if (snapshot->next != NULL) {
+        snapshot->next->prev = snapshot->prev;
+    }
+
+    pager_prune_versions(pager);
+    pthread_mutex_unlock(&(pager->lock));
+}
+
+// the page as the snapshot sees it: a version the writer left behind, which stays put until the snapshot ends, or a
+// copy of the current page in `buffer`. The page is only latched for the lookup and the copy
+void*
+snapshot_read_page(Snapshot* snapshot, uint32_t page_num, void* buffer) {
+    Pager* pager = snapshot->table->pager;
+    void* page = pager_latch(pager, page_num, LATCH_SHARED);
+
+    pthread_mutex_lock(&(pager->lock));
+
+    PageVersion* version = pager_find_version(pager, page_num, snapshot->seq);
+
+    pthread_mutex_unlock(&(pager->lock));
+
+    void* image = version != NULL ? version->data : buffer;
+
+    if (version == NULL) {
+        memcpy(buffer, page, PAGE_SIZE);
+    }
+
+    pager_unlatch(pager, page_num);
+
+    return image;
+}
+
+uint32_t crc32_table[256];
+pthread_once_t crc32_table_once = PTHREAD_ONCE_INIT;
+
+void
+crc32_init_table() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+
+        crc32_table[i] = crc;
+    }
+}
+
+uint32_t
+crc32_update(uint32_t crc, const void* data, size_t length) {
+    const uint8_t* bytes = data;
+
+    pthread_once(&crc32_table_once, crc32_init_table);
+
+    crc = ~crc;
+
+    for (size_t i = 0; i < length; i++) {
+        crc = crc32_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+uint32_t
+wal_record_crc(uint32_t salt, WalRecordHeader* record, const void* payload) {
+    uint32_t crc = crc32_update(salt, &(record->page_num), sizeof(WalRecordHeader) - sizeof(record->crc));
+
+    return crc32_update(crc, payload, record->length);
+}
+
+Wal*
+wal_open(const char* db_filename, uint32_t commit_window_ms, bool synchronous, uint64_t checkpoint_bytes) {
+    size_t filename_length = strlen(db_filename) + sizeof("-wal");
+    char* filename = malloc(filename_length);
+
+    snprintf(filename, filename_length, "%s-wal", db_filename);
+
+    int fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+
+    free(filename);
+
+    if (fd == -1) {
+        printf("unable to open wal file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Wal* wal = malloc(sizeof(Wal));
+
+    wal->fd = fd;
+    wal->salt = (uint32_t) time(NULL);
+    wal->commit_window_ms = commit_window_ms;
+    wal->synchronous = synchronous;
+    wal->checkpoint_bytes = checkpoint_bytes;
+    wal->running = false;
+    wal->syncing = false;
+    wal->buffer = NULL;
+    wal->buffer_length = 0;
+    wal->buffer_capacity = 0;
+    wal->spare = NULL;
+    wal->spare_capacity = 0;
+    wal->append_lsn = 0;
+    wal->durable_lsn = 0;
+
+    pthread_mutex_init(&(wal->lock), NULL);
+    pthread_cond_init(&(wal->wake), NULL);
+    pthread_cond_init(&(wal->synced), NULL);
+
+    return wal;
+}
+
+void
+wal_append_locked(Wal* wal, WalRecordHeader* record, const void* payload) {
+    size_t needed = wal->buffer_length + sizeof(WalRecordHeader) + record->length;
+
+    if (needed > wal->buffer_capacity) {
+        size_t capacity = wal->buffer_capacity == 0 ? 64 * 1024 : wal->buffer_capacity;
+
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+
+        wal->buffer = realloc(wal->buffer, capacity);
+        wal->buffer_capacity = capacity;
+    }
+
+    record->crc = wal_record_crc(wal->salt, record, payload);
+
+    memcpy(wal->buffer + wal->buffer_length, record, sizeof(WalRecordHeader));
+    if (record->length > 0) {
+        memcpy(wal->buffer + wal->buffer_length + sizeof(WalRecordHeader), payload, record->length);
+    }
+
+    wal->buffer_length = needed;
+    wal->append_lsn += sizeof(WalRecordHeader) + record->length;
+}
+
+// logs the byte ranges that differ between the two images of the page, ranges closer than WAL_DELTA_MERGE_GAP are
+// logged as one
+void
+wal_log_page_delta_locked(Wal* wal, uint32_t page_num, const uint8_t* before, const uint8_t* after) {
+    uint32_t i = 0;
+
+    while (i < PAGE_SIZE) {
+        if (i + sizeof(uint64_t) <= PAGE_SIZE && memcmp(before + i, after + i, sizeof(uint64_t)) == 0) {
+            i += sizeof(uint64_t);
+            continue;
+        }
+
+        if (before[i] == after[i]) {
+            i++;
+            continue;
+        }
+
+        uint32_t start = i;
+        uint32_t end = i + 1;
+
+        for (uint32_t j = end; j < PAGE_SIZE && j < end + WAL_DELTA_MERGE_GAP; j++) {
+            if (before[j] != after[j]) {
+                end = j + 1;
+            }
+        }
+
+        WalRecordHeader record = {0};
+
+        record.type = WAL_PAGE_DELTA;
+        record.page_num = page_num;
+        record.offset = start;
+        record.length = end - start;
+
+        wal_append_locked(wal, &record, after + start);
+
+        i = end;
+    }
+}
+
+// group sync: the first caller to find records that aren't durable writes and syncs everything appended so far,
+// whoever shows up meanwhile waits for it and, if still needed, leads the next one
+void
+wal_flush_locked(Wal* wal, uint64_t lsn) {
+    while (wal->durable_lsn < lsn) {
+        if (wal->syncing) {
+            pthread_cond_wait(&(wal->synced), &(wal->lock));
+            continue;
+        }
+
+        char* data = wal->buffer;
+        size_t length = wal->buffer_length;
+        size_t capacity = wal->buffer_capacity;
+        uint64_t target_lsn = wal->append_lsn;
+        off_t offset = target_lsn - length;
+
+        // keep accepting appends in the spare buffer while this one is written out
+        wal->syncing = true;
+        wal->buffer = wal->spare;
+        wal->buffer_capacity = wal->spare_capacity;
+        wal->buffer_length = 0;
+        wal->spare = data;
+        wal->spare_capacity = capacity;
+
+        pthread_mutex_unlock(&(wal->lock));
+
+        size_t written = 0;
+
+        while (written < length) {
+            ssize_t bytes_written = pwrite(wal->fd, data + written, length - written, offset + written);
+
+            if (bytes_written == -1) {
+                printf("error writing wal: %d\n", errno);
+                exit(EXIT_FAILURE);
+            }
+
+            written += bytes_written;
+        }
+
+        if (fdatasync(wal->fd) == -1) {
+            printf("error syncing wal: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+
+        pthread_mutex_lock(&(wal->lock));
+
+        wal->durable_lsn = target_lsn;
+        wal->syncing = false;
+        pthread_cond_broadcast(&(wal->synced));
+    }
+}
+
+// makes everything appended so far durable
+void
+wal_flush(Wal* wal) {
+    pthread_mutex_lock(&(wal->lock));
+    wal_flush_locked(wal, wal->append_lsn);
+    pthread_mutex_unlock(&(wal->lock));
+}
+
+// waits for the commit ending at `lsn` to be durable, used by callers that need to acknowledge durable commits
+void
+wal_wait(Wal* wal, uint64_t lsn) {
+    pthread_mutex_lock(&(wal->lock));
+    wal_flush_locked(wal, lsn);
+    pthread_mutex_unlock(&(wal->lock));
+}
+
+// group commit writer, once a commit shows up it lets the window go by so every commit appended meanwhile shares the
+// same fdatasync
+void*
+wal_writer_main(void* arg) {
+    Wal* wal = arg;
+    struct timespec window = {
+        .tv_sec = wal->commit_window_ms / 1000,
+        .tv_nsec = (wal->commit_window_ms % 1000) * 1000000L,
+    };
+
+    pthread_mutex_lock(&(wal->lock));
+
+    while (wal->running) {
+        if (wal->durable_lsn == wal->append_lsn) {
+            pthread_cond_wait(&(wal->wake), &(wal->lock));
+            continue;
+        }
+
+        pthread_mutex_unlock(&(wal->lock));
+        nanosleep(&window, NULL);
+        pthread_mutex_lock(&(wal->lock));
+
+        wal_flush_locked(wal, wal->append_lsn);
+    }
+
+    pthread_mutex_unlock(&(wal->lock));
+
+    return NULL;
+}
+
+void
+wal_start_writer(Wal* wal) {
+    wal->running = true;
+
+    if (pthread_create(&(wal->writer), NULL, wal_writer_main, wal) != 0) {
+        printf("unable to start the wal writer\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// starts a new generation of the log, only valid once every logged change reached the database file
+void
+wal_reset(Wal* wal) {
+    pthread_mutex_lock(&(wal->lock));
+
+    wal->salt += 1;
+
+    WalHeader header = {
+        .magic = WAL_MAGIC,
+        .version = WAL_VERSION,
+        .page_size = PAGE_SIZE,
+        .salt = wal->salt,
+    };
+
+    if (pwrite(wal->fd, &header, sizeof(WalHeader), 0) != sizeof(WalHeader)
+        || ftruncate(wal->fd, sizeof(WalHeader)) == -1 || fdatasync(wal->fd) == -1) {
+        printf("error resetting wal: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    wal->buffer_length = 0;
+    wal->append_lsn = sizeof(WalHeader);
+    wal->durable_lsn = sizeof(WalHeader);
+
+    pthread_mutex_unlock(&(wal->lock));
+}
+
+void
+wal_close(Wal* wal) {
+    if (wal->running) {
+        pthread_mutex_lock(&(wal->lock));
+        wal->running = false;
+        pthread_cond_signal(&(wal->wake));
+        pthread_mutex_unlock(&(wal->lock));
+        pthread_join(wal->writer, NULL);
+    }
+
+    if (close(wal->fd) == -1) {
+        printf("error closing wal file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_destroy(&(wal->lock));
+    pthread_cond_destroy(&(wal->wake));
+    pthread_cond_destroy(&(wal->synced));
+    free(wal->buffer);
+    free(wal->spare);
+    free(wal);
+}
+
+void
+pager_begin(Pager* pager) {
+    if (pager->txn_active) {
+        printf("tried to begin a transaction inside another one\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // NOTE: the pages are tracked with or without a log, a snapshot opened halfway through reads their pre-images
+    pthread_mutex_lock(&(pager->lock));
+    pager->txn_active = true;
+    pthread_mutex_unlock(&(pager->lock));
+}
+
+// logs the changes of the running transaction as page deltas followed by a commit record and releases its pages
+void
+pager_commit(Pager* pager) {
+    // the snapshots opened from here on see the transaction whole, the ones opened before it never do
+    pthread_mutex_lock(&(pager->lock));
+
+    bool txn_active = pager->txn_active;
+
+    pager->commit_seq += 1;
+    pager->txn_active = false;
+    pthread_mutex_unlock(&(pager->lock));
+
+    if (!txn_active) {
+        return;
+    }
+
+    Wal* wal = pager->wal;
+
+    if (wal != NULL && pager->txn_num_pages > 0) {
+        pthread_mutex_lock(&(wal->lock));
+
+        for (uint32_t i = 0; i < pager->txn_num_pages; i++) {
+            wal_log_page_delta_locked(wal, pager->txn_page_nums[i], pager->txn_pre_images[i], pager->txn_pages[i]);
+        }
+
+        WalRecordHeader commit = {0};
+
+        commit.type = WAL_COMMIT;
+        commit.page_num = pager->num_pages;
+
+        wal_append_locked(wal, &commit, NULL);
+
+        if (wal->synchronous) {
+            wal_flush_locked(wal, wal->append_lsn);
+        } else {
+            pthread_cond_signal(&(wal->wake));
+        }
+
+        pthread_mutex_unlock(&(wal->lock));
+    }
+
+    for (uint32_t i = 0; i < pager->txn_num_pages; i++) {
+        unpin_page(pager, pager->txn_page_nums[i]);
+    }
+
+    pager->txn_num_pages = 0;
+
+    if (wal != NULL && wal->append_lsn - sizeof(WalHeader) >= wal->checkpoint_bytes) {
+        pager_checkpoint(pager);
+    }
+}
+
+// copies what the log describes into the database file, by writing back the cached pages that hold those changes, and
+// starts a new log
+void
+pager_checkpoint(Pager* pager) {
+    pager_flush_dirty(pager);
+
+    if (fdatasync(pager->fd) == -1) {
+        printf("error syncing db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    wal_reset(pager->wal);
+}
+
+// replays the committed transactions found in the log, a torn or incomplete tail is what a crash leaves behind while
+// appending and is ignored
+void
+pager_recover(Pager* pager) {
+    Wal* wal = pager->wal;
+    off_t length = lseek(wal->fd, 0, SEEK_END);
+
+    if (length < (off_t) sizeof(WalHeader)) {
+        return;
+    }
+
+    uint8_t* log = malloc(length);
+    off_t bytes_read = 0;
+
+    while (bytes_read < length) {
+        ssize_t result = pread(wal->fd, log + bytes_read, length - bytes_read, bytes_read);
+
+        if (result <= 0) {
+            printf("error reading wal: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+
+        bytes_read += result;
+    }
+
+    WalHeader* header = (WalHeader*) log;
+
+    if (header->magic != WAL_MAGIC || header->version != WAL_VERSION || header->page_size != PAGE_SIZE) {
+        printf("wal file is not a durc log. corrupted file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    wal->salt = header->salt;
+
+    off_t txn_start = sizeof(WalHeader);
+    off_t offset = txn_start;
+
+    // NOTE: records follow each other with no padding, a header is copied out of the log before its fields are read
+    while (offset + (off_t) sizeof(WalRecordHeader) <= length) {
+        WalRecordHeader record;
+        uint8_t* payload = log + offset + sizeof(WalRecordHeader);
+
+        memcpy(&record, log + offset, sizeof(WalRecordHeader));
+
+        if (record.length > length - offset - sizeof(WalRecordHeader)
+            || record.crc != wal_record_crc(wal->salt, &record, payload)) {
+            break;
+        }
+
+        if (record.type == WAL_PAGE_DELTA && record.offset + record.length > PAGE_SIZE) {
+            break;
+        }
+
+        offset += sizeof(WalRecordHeader) + record.length;
+
+        if (record.type == WAL_PAGE_DELTA) {
+            continue;
+        } else if (record.type != WAL_COMMIT) {
+            break;
+        }
+
+        while (txn_start < offset) {
+            WalRecordHeader delta;
+
+            memcpy(&delta, log + txn_start, sizeof(WalRecordHeader));
+
+            if (delta.type == WAL_PAGE_DELTA) {
+                void* page = get_page(pager, delta.page_num);
+
+                pager_mark_dirty(pager, delta.page_num);
+                memcpy(page + delta.offset, log + txn_start + sizeof(WalRecordHeader), delta.length);
+                unpin_page(pager, delta.page_num);
+            }
+
+            txn_start += sizeof(WalRecordHeader) + delta.length;
+        }
+    }
+
+    free(log);
+}
+
+Table*
+db_open(const char* filename, DbOptions* options) {
+    uint32_t num_frames = PAGER_DEFAULT_FRAMES;
+    uint32_t flush_threshold = PAGER_DEFAULT_FLUSH_THRESHOLD;
+
+    if (options != NULL && options->cache_frames != 0) {
+        num_frames = options->cache_frames;
+    }
+
+    if (options != NULL && options->flush_threshold != 0) {
+        flush_threshold = options->flush_threshold;
+    }
+
+    PagerMode mode = PAGER_BUFFERED;
+
+    if (options != NULL) {
+        mode = options->pager_mode;
+    }
+
+    Pager* pager = pager_open(filename, mode, num_frames, flush_threshold);
+
+    if (options == NULL || !options->disable_wal) {
+        uint32_t commit_window_ms = WAL_DEFAULT_COMMIT_WINDOW_MS;
+        uint64_t checkpoint_bytes = WAL_DEFAULT_CHECKPOINT_BYTES;
+        bool synchronous = false;
+
+        if (options != NULL && options->commit_window_ms != 0) {
+            commit_window_ms = options->commit_window_ms;
+        }
+
+        if (options != NULL && options->checkpoint_bytes != 0) {
+            checkpoint_bytes = options->checkpoint_bytes;
+        }
+
+        if (options != NULL) {
+            synchronous = options->synchronous_commit;
+        }
+
+        // NOTE: the mmap pager can't hold pages back from the kernel writeback, so there the log only replays
+        // committed changes and can't protect a half written statement the way it does for the buffer pool, a crash
+        // under PAGER_MMAP isn't atomic
+        pager->wal = wal_open(filename, commit_window_ms, synchronous, checkpoint_bytes);
+        pager_recover(pager);
+        pager_checkpoint(pager);
+        wal_start_writer(pager->wal);
+    }
+
+    Table* table = malloc(sizeof(Table));
+    table->pager = pager;
+    table->root_page_num = 0;
+    pthread_mutex_init(&(table->writer_lock), NULL);
+    table->scan_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (options != NULL && options->scan_threads != 0) {
+        table->scan_threads = options->scan_threads;
+    }
+
+    table->bloom_extents = NULL;
+    table->num_indexes = 0;
+    table->leaf_splits = 0;
+    table->internal_splits = 0;
+    memset(&(table->insert_latency), 0, sizeof(LatencyHistogram));
+    memset(&(table->select_latency), 0, sizeof(LatencyHistogram));
+
+    if (pager->num_pages == 0) {
+        pager_begin(pager);
+
+        void* root_node = get_page(pager, 0);
+        pager_mark_dirty(pager, 0);
+        init_leaf_node(root_node);
+        set_node_root(root_node, true);
+        unpin_page(pager, 0);
+
+        pager_commit(pager);
+    }
+
+    table_catalog_load(table);
+
+    if (options != NULL && options->bloom_filters) {
+        table_bloom_build(table);
+    }
+
+    return table;
+}
+
+void
+db_close(Table* table) {
+    Pager* pager = table->pager;
+
+    // only what changed since the last flush is written, untouched cached pages are just dropped
+    if (pager->wal != NULL) {
+        pager_checkpoint(pager);
+        wal_close(pager->wal);
+    } else {
+        pager_flush_dirty(pager);
+    }
+
+    if (pager->mode == PAGER_MMAP) {
+        munmap(pager->map, PAGER_MMAP_RESERVE);
+
+        // give back the unused tail of the last extent
+        if (ftruncate(pager->fd, (off_t) pager->num_pages * PAGE_SIZE) == -1) {
+            printf("error truncating db file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    int result = close(pager->fd);
+
+    if (result == -1) {
+        printf("error closing db file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < pager->txn_capacity; i++) {
+        free(pager->txn_pre_images[i]);
+    }
+
+    for (uint32_t i = 0; i < pager->num_frames; i++) {
+        pthread_rwlock_destroy(&(pager->frames[i].latch));
+    }
+
+    for (off_t offset = 0; offset < pager->map_length; offset += PAGER_MMAP_EXTENT) {
+        for (uint32_t i = 0; i < PAGER_MMAP_EXTENT_PAGES; i++) {
+            pthread_rwlock_destroy(&(pager->latch_extents[offset / PAGER_MMAP_EXTENT][i]));
+        }
+
+        free(pager->latch_extents[offset / PAGER_MMAP_EXTENT]);
+    }
+
+    pthread_mutex_destroy(&(pager->lock));
+    pthread_mutex_destroy(&(table->writer_lock));
+
+    if (table->bloom_extents != NULL) {
+        for (uint32_t i = 0; i < BLOOM_MAX_EXTENTS; i++) {
+            free(table->bloom_extents[i]);
+        }
+
+        free(table->bloom_extents);
+    }
+
+    for (uint32_t i = 0; i < table->num_indexes; i++) {
+        free(table->indexes[i].entries);
+    }
+
+    free(pager->txn_page_nums);
+    free(pager->txn_pages);
+    free(pager->txn_pre_images);
+    pager_prune_versions(pager);
+
+    while (pager->free_versions != NULL) {
+        PageVersion* version = pager->free_versions;
+
+        pager->free_versions = version->next;
+        free(version->data);
+        free(version);
+    }
+
+    free(pager->version_buckets);
+    free(pager->dirty_bitmap);
+    free(pager->latch_extents);
+    free(pager->flush_list);
+    if (pager->frame_memory != NULL) {
+        munmap(pager->frame_memory, pager->frame_memory_length);
+    }
+
+    free(pager->frames);
+    free(pager->buckets);
+    free(pager);
+    free(table);
+}
+
+// NOTE: the scan starts at the leftmost leaf, where the search for the smallest possible key lands
+Cursor*
+table_start(Table* table) {
+    return table_seek(table, 0);
+}
+
+// positions the cursor on the first cell with a key >= key, following the leaf chain when the leaf found by the
+// descent holds no such key. The cursor holds a shared latch on its leaf until cursor_close
+Cursor*
+table_seek(Table* table, uint32_t key) {
+    Cursor* cursor = malloc(sizeof(Cursor));
+
+    cursor_seek(cursor, table, key);
+
+    return cursor;
+}
+
+// table_seek into a cursor the caller owns
+void
+cursor_seek(Cursor* cursor, Table* table, uint32_t key) {
+    cursor_find(cursor, table, key, LATCH_SHARED);
+    cursor_settle(cursor);
+}
+
+// same as table_seek over the table as the snapshot sees it, the cursor holds no latch between two calls
+Cursor*
+snapshot_seek(Snapshot* snapshot, uint32_t key) {
+    Cursor* cursor = malloc(sizeof(Cursor));
+
+    snapshot_cursor_seek(cursor, snapshot, key, malloc(PAGE_SIZE));
+
+    return cursor;
+}
+
+// snapshot_seek into a cursor the caller owns. `leaf_buffer` takes the copies of the pages read on the way and must
+// outlive the cursor, a PAGE_SIZE array on the stack of the caller will do. The cursor holds no latch, there's
+// nothing to let go of once done with it
+void
+snapshot_cursor_seek(Cursor* cursor, Snapshot* snapshot, uint32_t key, void* leaf_buffer) {
+    Table* table = snapshot->table;
+
+    cursor->table = table;
+    cursor->snapshot = snapshot;
+    cursor->leaf_copy = leaf_buffer;
+    cursor->depth = 0;
+    cursor->latch_depth = 0;
+
+    // NOTE: every node goes through the same buffer, the child page number is read before the child overwrites it
+    uint32_t page_num = table->root_page_num;
+    void* node = snapshot_read_page(snapshot, page_num, cursor->leaf_copy);
+
+    while (get_node_type(node) == NODE_INTERNAL) {
+        page_num = *internal_node_child(node, internal_node_find_child(node, key));
+        node = snapshot_read_page(snapshot, page_num, cursor->leaf_copy);
+    }
+
+    cursor->page_num = page_num;
+    cursor->node = node;
+    leaf_node_find(cursor, key);
+    cursor_settle(cursor);
+}
+
+// rows of the snapshot with an id lower than `key`, or up to `key` when inclusive. The counts of the children left of
+// the path are added up on the way down
+uint64_t
+snapshot_rank(Snapshot* snapshot, uint32_t key, bool inclusive) {
+    uint8_t buffer[PAGE_SIZE];
+    void* node = snapshot_read_page(snapshot, snapshot->table->root_page_num, buffer);
+    uint64_t rank = 0;
+
+    while (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t child_num = internal_node_find_child(node, key);
+
+        for (uint32_t i = 0; i < child_num; i++) {
+            rank += *internal_node_count(node, i);
+        }
+
+        node = snapshot_read_page(snapshot, *internal_node_child(node, child_num), buffer);
+    }
+
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t cell_num = leaf_node_lower_bound(leaf_node_key(node, 0), num_cells, key);
+
+    rank += cell_num;
+
+    if (inclusive && cell_num < num_cells && *leaf_node_key(node, cell_num) == key) {
+        rank += 1;
+    }
+
+    return rank;
+}
+
+// the id of the row at `position` in id order, false when the snapshot doesn't have that many rows
+bool
+snapshot_key_at(Snapshot* snapshot, uint64_t position, uint32_t* key) {
+    uint8_t buffer[PAGE_SIZE];
+    void* node = snapshot_read_page(snapshot, snapshot->table->root_page_num, buffer);
+
+    while (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t num_keys = *internal_node_num_keys(node);
+        uint32_t child_num = 0;
+
+        while (child_num < num_keys && position >= *internal_node_count(node, child_num)) {
+            position -= *internal_node_count(node, child_num);
+            child_num++;
+        }
+
+        node = snapshot_read_page(snapshot, *internal_node_child(node, child_num), buffer);
+    }
+
+    bool found = position < *leaf_node_num_cells(node);
+
+    if (found) {
+        *key = *leaf_node_key(node, position);
+    }
+
+    return found;
+}
+
+// false when the snapshot surely holds no row with this id. The descent stops at the parent of the leaf when the leaf
+// has a Bloom filter, the leaf itself is only read when it has none
+bool
+snapshot_may_contain(Snapshot* snapshot, uint32_t key) {
+    Table* table = snapshot->table;
+
+    if (table->bloom_extents == NULL) {
+        return true;
+    }
+
+    uint8_t buffer[PAGE_SIZE];
+    void* node = snapshot_read_page(snapshot, table->root_page_num, buffer);
+
+    while (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t child_page_num = *internal_node_child(node, internal_node_find_child(node, key));
+        BloomFilter* filter = bloom_filter(table, child_page_num, false);
+
+        // NOTE: the root changes from leaf to internal node, it never counts as a leaf here
+        bool leaf = filter != NULL && __atomic_load_n(&(filter->leaf), __ATOMIC_ACQUIRE);
+
+        if (leaf && child_page_num != table->root_page_num) {
+            return bloom_may_contain(filter, key);
+        }
+
+        node = snapshot_read_page(snapshot, child_page_num, buffer);
+    }
+
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t cell_num = leaf_node_lower_bound(leaf_node_key(node, 0), num_cells, key);
+
+    return cell_num < num_cells && *leaf_node_key(node, cell_num) == key;
+}
+
+// an index on the column the snapshot can read, NULL when there's none. An index made after the snapshot began didn't
+// exist as of the snapshot, its pages have no image the snapshot could read
+Index*
+snapshot_index(Snapshot* snapshot, Column column) {
+    Table* table = snapshot->table;
+    uint32_t num_indexes = __atomic_load_n(&(table->num_indexes), __ATOMIC_ACQUIRE);
+
+    for (uint32_t i = 0; i < num_indexes; i++) {
+        if (table->indexes[i].column == column && table->indexes[i].seq <= snapshot->seq) {
+            return &(table->indexes[i]);
+        }
+    }
+
+    return NULL;
+}
+
+// moves the cursor to the first cell of the next leaf. A latched cursor latches the next leaf before it lets go of the
+// current one so a split can't slip in between. Returns false on the last leaf
+bool
+cursor_next_leaf(Cursor* cursor) {
+    Pager* pager = cursor->table->pager;
+    uint32_t next_page_num = *leaf_node_next_leaf(cursor->node);
+
+    if (next_page_num == INVALID_PAGE_NUM) {
+        return false;
+    }
+
+    if (cursor->snapshot != NULL) {
+        cursor->node = snapshot_read_page(cursor->snapshot, next_page_num, cursor->leaf_copy);
+    } else {
+        void* next = pager_latch(pager, next_page_num, LATCH_SHARED);
+
+        pager_unlatch(pager, cursor->page_num);
+        cursor->node = next;
+    }
+
+    cursor->page_num = next_page_num;
+    cursor->cell_num = 0;
+
+    return true;
+}
+
+// moves on to the following leaves while the cursor is past the last cell of its leaf
+// NOTE: a leaf is never left empty, but the loop keeps that assumption out of the scan
+void
+cursor_settle(Cursor* cursor) {
+    while (cursor->cell_num >= (*leaf_node_num_cells(cursor->node))) {
+        if (!cursor_next_leaf(cursor)) {
+            cursor->end_of_table = true;
+            return;
+        }
+    }
+}
+
+void
+cursor_advance(Cursor* cursor) {
+    cursor->cell_num += 1;
+    cursor_settle(cursor);
+}
+
+// lets go of the ancestors of the leaf still latched, once the leaf is known not to split
+void
+cursor_release_ancestors(Cursor* cursor) {
+    for (uint32_t level = cursor->latch_depth; level < cursor->depth; level++) {
+        pager_unlatch(cursor->table->pager, cursor->path[level]);
+    }
+
+    cursor->latch_depth = cursor->depth;
+}
+
+void
+cursor_unlatch(Cursor* cursor) {
+    if (cursor->snapshot != NULL) {
+        return;
+    }
+
+    cursor_release_ancestors(cursor);
+    pager_unlatch(cursor->table->pager, cursor->page_num);
+}
+
+void
+cursor_close(Cursor* cursor) {
+    cursor_unlatch(cursor);
+    free(cursor->leaf_copy);
+    free(cursor);
+}
+
+// NOTE: this functions is used as a pointer arithmetic operations to get the memory address that the value will be
+// stored or accessed
+uint32_t*
+leaf_node_num_cells(void* node) {
+    return node + LEAF_NODE_NUM_CELLS_OFFSET;
+}
+
+uint32_t*
+leaf_node_next_leaf(void* node) {
+    return node + LEAF_NODE_NEXT_LEAF_OFFSET;
+}
+
+uint16_t*
+leaf_node_content_start(void* node) {
+    return node + LEAF_NODE_CONTENT_START_OFFSET;
+}
+
+uint32_t*
+leaf_node_key(void* node, uint32_t cell_num) {
+    return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_KEY_SIZE;
+}
+
+// NOTE: the slot array starts right after the last key, so it moves whenever the number of cells changes
+uint16_t*
+leaf_node_slot(void* node, uint32_t cell_num) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+
+    return node + LEAF_NODE_HEADER_SIZE + num_cells * LEAF_NODE_KEY_SIZE + cell_num * LEAF_NODE_SLOT_SIZE;
+}
+
+void*
+leaf_node_value(void* node, uint32_t cell_num) {
+    return node + *leaf_node_slot(node, cell_num);
+}
+
+void
+init_leaf_node(void* node) {
+    set_node_type(node, NODE_LEAF);
+    set_node_root(node, false);
+    *leaf_node_num_cells(node) = 0;
+    *leaf_node_next_leaf(node) = INVALID_PAGE_NUM;
+    *leaf_node_content_start(node) = PAGE_SIZE;
+    *leaf_node_fragmented_bytes(node) = 0;
+}
+
+uint16_t*
+leaf_node_fragmented_bytes(void* node) {
+    return node + LEAF_NODE_FRAGMENTED_OFFSET;
+}
+
+// contiguous free bytes between the slot array and the payloads
+uint32_t
+leaf_node_free_space(void* node) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+
+    return *leaf_node_content_start(node) - (LEAF_NODE_HEADER_SIZE + num_cells * LEAF_NODE_CELL_OVERHEAD);
+}
+
+// whether a cell with a payload of `size` bytes fits, maybe after compacting the leaf
+bool
+leaf_node_has_room(void* node, uint32_t size) {
+    return leaf_node_free_space(node) + *leaf_node_fragmented_bytes(node) >= LEAF_NODE_CELL_OVERHEAD + size;
+}
+
+// makes room for a cell at cell_num and returns where its payload of `size` bytes goes, the caller made sure there's
+// enough contiguous free space
+void*
+leaf_node_alloc_cell(void* node, uint32_t cell_num, uint32_t key, uint32_t size) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    void* slots = leaf_node_slot(node, 0);
+
+    // the slot array moves one key to the right to make room for the new key, the slots after cell_num move one slot
+    // further for the new slot. The slots go first, the key array grows into where they were
+    memmove(slots + LEAF_NODE_KEY_SIZE + (cell_num + 1) * LEAF_NODE_SLOT_SIZE,
+            slots + cell_num * LEAF_NODE_SLOT_SIZE,
+            (num_cells - cell_num) * LEAF_NODE_SLOT_SIZE);
+    memmove(slots + LEAF_NODE_KEY_SIZE, slots, cell_num * LEAF_NODE_SLOT_SIZE);
+    memmove(leaf_node_key(node, cell_num + 1),
+            leaf_node_key(node, cell_num),
+            (num_cells - cell_num) * LEAF_NODE_KEY_SIZE);
+
+    *leaf_node_num_cells(node) = num_cells + 1;
+    *leaf_node_content_start(node) -= size;
+    *leaf_node_key(node, cell_num) = key;
+    *leaf_node_slot(node, cell_num) = *leaf_node_content_start(node);
+
+    return node + *leaf_node_content_start(node);
+}
+
+// drops the cells from num_cells on, their payloads stay behind as fragmented bytes
+void
+leaf_node_truncate(void* node, uint32_t num_cells) {
+    uint32_t old_num_cells = *leaf_node_num_cells(node);
+
+    for (uint32_t i = num_cells; i < old_num_cells; i++) {
+        *leaf_node_fragmented_bytes(node) += row_payload_size(leaf_node_value(node, i));
+    }
+
+    // the slots of the cells left move down, right after their keys
+    memmove(node + LEAF_NODE_HEADER_SIZE + num_cells * LEAF_NODE_KEY_SIZE,
+            leaf_node_slot(node, 0),
+            num_cells * LEAF_NODE_SLOT_SIZE);
+
+    *leaf_node_num_cells(node) = num_cells;
+}
+
+// packs the payloads back against the end of the page, so the fragmented bytes become contiguous free space again
+void
+leaf_node_compact(void* node) {
+    uint8_t old_copy[PAGE_SIZE];
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t content_start = PAGE_SIZE;
+
+    memcpy(old_copy, node, PAGE_SIZE);
+
+    for (uint32_t i = 0; i < num_cells; i++) {
+        void* payload = leaf_node_value(old_copy, i);
+        uint32_t size = row_payload_size(payload);
+
+        content_start -= size;
+        memcpy(node + content_start, payload, size);
+        *leaf_node_slot(node, i) = content_start;
+    }
+
+    *leaf_node_content_start(node) = content_start;
+    *leaf_node_fragmented_bytes(node) = 0;
+}
+
+// makes room for a cell at cell_num of a leaf with room for it and returns where its payload goes, the leaf is
+// compacted first when its free space isn't contiguous
+void*
+leaf_node_claim_cell(void* node, uint32_t cell_num, uint32_t key, uint32_t size) {
+    if (leaf_node_free_space(node) < LEAF_NODE_CELL_OVERHEAD + size) {
+        leaf_node_compact(node);
+    }
+
+    return leaf_node_alloc_cell(node, cell_num, key, size);
+}
+
+// stores the row in a cell at cell_num of a leaf with room for it
+void
+leaf_node_put_row(void* node, uint32_t cell_num, uint32_t key, Row* data) {
+    row_serialize(data, leaf_node_claim_cell(node, cell_num, key, row_serialized_size(data)));
+}
+
+// same as leaf_node_put_row for a row already encoded the way it's stored
+void
+leaf_node_put_payload(void* node, uint32_t cell_num, uint32_t key, const void* payload, uint32_t size) {
+    memcpy(leaf_node_claim_cell(node, cell_num, key, size), payload, size);
+}
+
+// the cursor holds the leaf exclusively latched, along with every ancestor a split would change
+void
+leaf_node_insert(Cursor* cursor, uint32_t key, const void* payload, uint32_t size) {
+    void* node = cursor->node;
+
+    if (!leaf_node_has_room(node, size)) {
+        leaf_node_split_and_insert(cursor, key, payload, size);
+
+        return;
+    }
+
+    // the descent only knew the leaf might split, the row fits so nothing above it changes
+    cursor_release_ancestors(cursor);
+
+    pager_mark_dirty(cursor->table->pager, cursor->page_num);
+    leaf_node_put_payload(node, cursor->cell_num, key, payload, size);
+    bloom_add(cursor->table, cursor->page_num, key);
+}
+
+void
+display_constants() {
+    printf("row size: %d to %d\n"
+           "common node header size: %d\n"
+           "leaf node header size: %d\n"
+           "leaf node cell overhead: %d (key %d, slot %d)\n"
+           "leaf node space for cells: %d\n"
+           "leaf node cells: %d to %d\n"
+           "internal node header size: %d\n"
+           "internal node cell size: %d\n"
+           "internal node max keys: %d\n",
+           ROW_MIN_SIZE,
+           ROW_MAX_SIZE,
+           COMMON_NODE_HEADER_SIZE,
+           LEAF_NODE_HEADER_SIZE,
+           LEAF_NODE_CELL_OVERHEAD,
+           LEAF_NODE_KEY_SIZE,
+           LEAF_NODE_SLOT_SIZE,
+           LEAF_NODE_SPACE_FOR_CELLS,
+           LEAF_NODE_MIN_CELLS,
+           LEAF_NODE_MAX_CELLS,
+           INTERNAL_NODE_HEADER_SIZE,
+           INTERNAL_NODE_CELL_SIZE,
+           INTERNAL_NODE_MAX_KEYS);
+}
+
+// positions a cursor on the leaf that holds `key`, or where it would go, the leaf stays latched in `mode` until
+// cursor_close. An exclusive cursor also keeps the ancestors the insert of a row could split
+Cursor*
+table_find(Table* table, uint32_t key, LatchMode mode) {
+    Cursor* cursor = malloc(sizeof(Cursor));
+
+    cursor_find(cursor, table, key, mode);
+
+    return cursor;
+}
+
+// table_find into a cursor the caller owns, usually on its stack. It's let go of with cursor_unlatch, there's nothing
+// to free
+void
+cursor_find(Cursor* cursor, Table* table, uint32_t key, LatchMode mode) {
+    cursor->table = table;
+    cursor->snapshot = NULL;
+    cursor->leaf_copy = NULL;
+
+    if (mode == LATCH_EXCLUSIVE) {
+        // most inserts don't split, so the internal nodes are only share latched on a first try and readers keep going
+        // through them. A leaf that could split sends the writer down again, latching the whole way exclusively
+        internal_node_find(table, cursor, key, LATCH_SHARED, LATCH_EXCLUSIVE);
+
+        if (is_node_safe(cursor->node)) {
+            return;
+        }
+
+        cursor_unlatch(cursor);
+    }
+
+    internal_node_find(table, cursor, key, mode, mode);
+}
+
+// whether inserting a row below the node can't split it, so the latches above it aren't needed anymore
+bool
+is_node_safe(void* node) {
+    if (get_node_type(node) == NODE_LEAF) {
+        return leaf_node_has_room(node, ROW_MAX_SIZE);
+    }
+
+    return *internal_node_num_keys(node) < INTERNAL_NODE_MAX_KEYS;
+}
+
+// index of the first key >= key. The search range halves on every step and the comparison only picks the next base,
+// which compiles to a conditional move, so there are no mispredicted branches over the key array
+uint32_t
+leaf_node_lower_bound(const uint32_t* keys, uint32_t num_keys, uint32_t key) {
+    const uint32_t* base = keys;
+    uint32_t length = num_keys;
+
+    if (length == 0) {
+        return 0;
+    }
+
+    while (length > 1) {
+        uint32_t half = length / 2;
+
+        base = base[half] < key ? base + half : base;
+        length -= half;
+    }
+
+    return (base - keys) + (*base < key);
+}
+
+// positions the cursor on the first cell of its leaf with a key >= key
+void
+leaf_node_find(Cursor* cursor, uint32_t key) {
+    uint32_t num_cells = *leaf_node_num_cells(cursor->node);
+
+    cursor->end_of_table = false;
+    cursor->cell_num = leaf_node_lower_bound(leaf_node_key(cursor->node, 0), num_cells, key);
+}
+
+NodeType
+get_node_type(void* node) {
+    uint8_t type = *((uint8_t*) (node + NODE_TYPE_OFFSET));
+
+    return (NodeType) type;
+}
+
+void
+set_node_type(void* node, NodeType type) {
+    *((uint8_t*) (node + NODE_TYPE_OFFSET)) = (uint8_t) type;
+}
+
+void
+leaf_node_split_and_insert(Cursor* cursor, uint32_t key, const void* payload, uint32_t size) {
+    Pager* pager = cursor->table->pager;
+
+    __atomic_fetch_add(&(cursor->table->leaf_splits), 1, __ATOMIC_RELAXED);
+
+    void* old_node = get_page(pager, cursor->page_num);
+    uint32_t new_page_num = get_unused_page_num(pager);
+    void* new_node = get_page(pager, new_page_num);
+
+    pager_mark_dirty(pager, cursor->page_num);
+    pager_mark_dirty(pager, new_page_num);
+    init_leaf_node(new_node);
+
+    // the new leaf comes right after the old one in the chain
+    *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
+    *leaf_node_next_leaf(old_node) = new_page_num;
+
+    // cells are counted as if the new one were already in place, the first ones holding half of the bytes stay
+    uint32_t num_cells = *leaf_node_num_cells(old_node);
+    uint32_t cell_sizes[num_cells + 1];
+    uint32_t total_bytes = 0;
+
+    for (uint32_t i = 0; i <= num_cells; i++) {
+        if (i == cursor->cell_num) {
+            cell_sizes[i] = LEAF_NODE_CELL_OVERHEAD + size;
+        } else {
+            uint32_t source_cell = i > cursor->cell_num ? i - 1 : i;
+
+            cell_sizes[i] = LEAF_NODE_CELL_OVERHEAD + row_payload_size(leaf_node_value(old_node, source_cell));
+        }
+
+        total_bytes += cell_sizes[i];
+    }
+
+    uint32_t split = 0;
+    uint32_t left_bytes = 0;
+
+    while (split < num_cells && left_bytes < total_bytes / 2) {
+        left_bytes += cell_sizes[split];
+        split += 1;
+    }
+
+    for (uint32_t i = split; i <= num_cells; i++) {
+        uint32_t destination_cell = *leaf_node_num_cells(new_node);
+
+        if (i == cursor->cell_num) {
+            memcpy(leaf_node_alloc_cell(new_node, destination_cell, key, size), payload, size);
+        } else {
+            uint32_t source_cell = i > cursor->cell_num ? i - 1 : i;
+            uint32_t cell_size = cell_sizes[i] - LEAF_NODE_CELL_OVERHEAD;
+            void* destination =
+                leaf_node_alloc_cell(new_node, destination_cell, *leaf_node_key(old_node, source_cell), cell_size);
+
+            memcpy(destination, leaf_node_value(old_node, source_cell), cell_size);
+        }
+    }
+
+    // the moved cells leave their payloads behind, they're reclaimed when the leaf gets compacted
+    if (cursor->cell_num < split) {
+        leaf_node_truncate(old_node, split - 1);
+        leaf_node_put_payload(old_node, cursor->cell_num, key, payload, size);
+    } else {
+        leaf_node_truncate(old_node, split);
+    }
+
+    bool was_root = is_node_root(old_node);
+    uint32_t separator = *leaf_node_key(old_node, *leaf_node_num_cells(old_node) - 1);
+
+    bloom_add_leaf(cursor->table, cursor->page_num, old_node);
+    bloom_add_leaf(cursor->table, new_page_num, new_node);
+    unpin_page(pager, cursor->page_num);
+    unpin_page(pager, new_page_num);
+
+    if (was_root) {
+        create_new_root(cursor->table, new_page_num, separator);
+    } else {
+        internal_node_insert(cursor->table, cursor, cursor->depth - 1, separator, new_page_num);
+    }
+}
+
+uint32_t
+get_unused_page_num(Pager* pager) {
+    return pager->num_pages;
+}
+
+// the root always stays at table->root_page_num, so its contents move to a new left child and it becomes an internal
+// node with a single key
+void
+create_new_root(Table* table, uint32_t right_child_page_num, uint32_t separator) {
+    void* root = get_page(table->pager, table->root_page_num);
+    uint32_t left_child_page_num = get_unused_page_num(table->pager);
+    void* left_child = get_page(table->pager, left_child_page_num);
+
+    pager_mark_dirty(table->pager, table->root_page_num);
+    pager_mark_dirty(table->pager, left_child_page_num);
+
+    // move previous root to the left children
+    memcpy(left_child, root, PAGE_SIZE);
+    set_node_root(left_child, false);
+
+    if (get_node_type(left_child) == NODE_LEAF) {
+        bloom_add_leaf(table, left_child_page_num, left_child);
+    }
+
+    init_internal_node(root);
+    set_node_root(root, true);
+    *internal_node_num_keys(root) = 1;
+    *internal_node_child(root, 0) = left_child_page_num;
+    *internal_node_key(root, 0) = separator;
+    *internal_node_right_child(root) = right_child_page_num;
+
+    void* right_child = get_page(table->pager, right_child_page_num);
+
+    *internal_node_count(root, 0) = node_row_count(left_child);
+    *internal_node_count(root, 1) = node_row_count(right_child);
+
+    unpin_page(table->pager, right_child_page_num);
+    unpin_page(table->pager, table->root_page_num);
+    unpin_page(table->pager, left_child_page_num);
+}
+
+// a child of the internal node at `cursor->path[level]` has just split, `separator` is the greatest key left in it and
+// `right_child_page_num` holds the keys above it. The new child goes right after the one that split
+void
+internal_node_insert(Table* table, Cursor* cursor, uint32_t level, uint32_t separator, uint32_t right_child_page_num) {
+    Pager* pager = table->pager;
+    uint32_t page_num = cursor->path[level];
+    void* node = get_page(pager, page_num);
+    uint32_t num_keys = *internal_node_num_keys(node);
+    uint32_t index = internal_node_find_child(node, separator);
+
+    if (num_keys >= INTERNAL_NODE_MAX_KEYS) {
+        unpin_page(pager, page_num);
+        internal_node_split_and_insert(table, cursor, level, index, separator, right_child_page_num);
+
+        return;
+    }
+
+    pager_mark_dirty(pager, page_num);
+
+    // both halves of the split child are counted again, the one holding the new row has one more
+    memmove(internal_node_count(node, index + 2),
+            internal_node_count(node, index + 1),
+            (num_keys - index) * INTERNAL_NODE_COUNT_SIZE);
+    internal_node_count_child(pager, node, index, *internal_node_child(node, index));
+    internal_node_count_child(pager, node, index + 1, right_child_page_num);
+
+    if (index == num_keys) {
+        // the right child split, it becomes the last cell and the new node takes its place
+        uint32_t split_child_page_num = *internal_node_right_child(node);
+
+        *internal_node_num_keys(node) += 1;
+        *internal_node_child(node, index) = split_child_page_num;
+        *internal_node_key(node, index) = separator;
+        *internal_node_right_child(node) = right_child_page_num;
+    } else {
+        // the split child keeps its cell with the separator as key, the new node inherits the key it had
+        memmove(internal_node_key(node, index + 1),
+                internal_node_key(node, index),
+                (num_keys - index) * INTERNAL_NODE_KEY_SIZE);
+        memmove(internal_node_children(node) + index + 1,
+                internal_node_children(node) + index,
+                (num_keys - index) * INTERNAL_NODE_CHILD_SIZE);
+
+        *internal_node_num_keys(node) += 1;
+        *internal_node_key(node, index) = separator;
+        *internal_node_child(node, index + 1) = right_child_page_num;
+    }
+
+    unpin_page(pager, page_num);
+}
+
+// same as internal_node_insert but the node is full, so the keys are split between the node and a new sibling and the
+// middle key moves up to the parent
+void
+internal_node_split_and_insert(
+    Table* table, Cursor* cursor, uint32_t level, uint32_t index, uint32_t separator, uint32_t right_child_page_num) {
+    Pager* pager = table->pager;
+
+    __atomic_fetch_add(&(table->internal_splits), 1, __ATOMIC_RELAXED);
+
+    uint32_t old_page_num = cursor->path[level];
+    void* old_node = get_page(pager, old_page_num);
+    uint32_t num_keys = *internal_node_num_keys(old_node);
+    uint32_t keys[num_keys + 1];
+    uint32_t children[num_keys + 2];
+    uint32_t counts[num_keys + 2];
+
+    for (uint32_t i = 0; i < num_keys; i++) {
+        keys[i] = *internal_node_key(old_node, i);
+        children[i] = *internal_node_child(old_node, i);
+    }
+
+    children[num_keys] = *internal_node_right_child(old_node);
+    memcpy(counts, internal_node_count(old_node, 0), (num_keys + 1) * sizeof(uint32_t));
+
+    memmove(keys + index + 1, keys + index, (num_keys - index) * sizeof(uint32_t));
+    memmove(children + index + 2, children + index + 1, (num_keys - index) * sizeof(uint32_t));
+    memmove(counts + index + 2, counts + index + 1, (num_keys - index) * sizeof(uint32_t));
+    keys[index] = separator;
+    children[index + 1] = right_child_page_num;
+    num_keys += 1;
+
+    for (uint32_t i = index; i <= index + 1; i++) {
+        void* child = get_page(pager, children[i]);
+
+        counts[i] = node_row_count(child);
+        unpin_page(pager, children[i]);
+    }
+
+    uint32_t left_num_keys = num_keys / 2;
+    uint32_t promoted_key = keys[left_num_keys];
+    uint32_t new_page_num = get_unused_page_num(pager);
+    void* new_node = get_page(pager, new_page_num);
+
+    pager_mark_dirty(pager, old_page_num);
+    pager_mark_dirty(pager, new_page_num);
+    init_internal_node(new_node);
+
+    *internal_node_num_keys(old_node) = left_num_keys;
+    *internal_node_right_child(old_node) = children[left_num_keys];
+
+    for (uint32_t i = 0; i < left_num_keys; i++) {
+        *internal_node_key(old_node, i) = keys[i];
+        *internal_node_child(old_node, i) = children[i];
+    }
+
+    memcpy(internal_node_count(old_node, 0), counts, (left_num_keys + 1) * sizeof(uint32_t));
+
+    uint32_t right_num_keys = num_keys - left_num_keys - 1;
+
+    *internal_node_num_keys(new_node) = right_num_keys;
+    *internal_node_right_child(new_node) = children[num_keys];
+
+    for (uint32_t i = 0; i < right_num_keys; i++) {
+        *internal_node_key(new_node, i) = keys[left_num_keys + 1 + i];
+        *internal_node_child(new_node, i) = children[left_num_keys + 1 + i];
+    }
+
+    memcpy(internal_node_count(new_node, 0), counts + left_num_keys + 1, (right_num_keys + 1) * sizeof(uint32_t));
+
+    bool was_root = is_node_root(old_node);
+
+    unpin_page(pager, old_page_num);
+    unpin_page(pager, new_page_num);
+
+    if (was_root) {
+        create_new_root(table, new_page_num, promoted_key);
+    } else {
+        internal_node_insert(table, cursor, level - 1, promoted_key, new_page_num);
+    }
+}
+
+uint32_t*
+internal_node_num_keys(void* node) {
+    return node + INTERNAL_NODE_NUM_KEYS_OFFSET;
+}
+
+uint32_t*
+internal_node_right_child(void* node) {
+    return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
+}
+
+uint32_t*
+internal_node_keys(void* node) {
+    return node + INTERNAL_NODE_KEYS_OFFSET;
+}
+
+uint32_t*
+internal_node_children(void* node) {
+    return node + INTERNAL_NODE_CHILDREN_OFFSET;
+}
+
+uint32_t*
+internal_node_child(void* node, uint32_t child_num) {
+    uint32_t num_keys = *internal_node_num_keys(node);
+
+    if (child_num > num_keys) {
+        printf("trying to access an invalid children\n");
+        exit(EXIT_FAILURE);
+    } else if (child_num == num_keys) {
+        return internal_node_right_child(node);
+    } else {
+        return internal_node_children(node) + child_num;
+    }
+}
+
+uint32_t*
+internal_node_key(void* node, uint32_t key_num) {
+    return internal_node_keys(node) + key_num;
+}
+
+// rows under a child, `child_num` == num_keys is the right child
+uint32_t*
+internal_node_count(void* node, uint32_t child_num) {
+    return (uint32_t*) (node + INTERNAL_NODE_COUNTS_OFFSET) + child_num;
+}
+
+// rows in the subtree of a node
+uint32_t
+node_row_count(void* node) {
+    if (get_node_type(node) == NODE_LEAF) {
+        return *leaf_node_num_cells(node);
+    }
+
+    uint32_t num_rows = 0;
+
+    for (uint32_t i = 0; i <= *internal_node_num_keys(node); i++) {
+        num_rows += *internal_node_count(node, i);
+    }
+
+    return num_rows;
+}
+
+void
+internal_node_count_child(Pager* pager, void* node, uint32_t child_num, uint32_t child_page_num) {
+    void* child = get_page(pager, child_page_num);
+
+    *internal_node_count(node, child_num) = node_row_count(child);
+    unpin_page(pager, child_page_num);
+}
+
+// adds the inserted row to the counts of the ancestors a split didn't reach, the nodes it went through were counted
+// again from their children. Every ancestor is latched on its own, top-down, once the leaf was let go
+void
+internal_node_count_row(Table* table, const uint32_t* path, uint32_t depth, uint32_t key) {
+    Pager* pager = table->pager;
+
+    for (uint32_t level = 0; level < depth; level++) {
+        void* node = pager_latch(pager, path[level], LATCH_EXCLUSIVE);
+
+        pager_mark_dirty(pager, path[level]);
+        *internal_node_count(node, internal_node_find_child(node, key)) += 1;
+        pager_unlatch(pager, path[level]);
+    }
+}
+
+// NOTE: the keys of an internal node only bound its left children, the greatest key lives down the right child
+uint32_t
+get_node_max_key(Pager* pager, void* node) {
+    if (get_node_type(node) == NODE_LEAF) {
+        return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+    }
+
+    uint32_t right_child_page_num = *internal_node_right_child(node);
+    void* right_child = get_page(pager, right_child_page_num);
+    uint32_t max_key = get_node_max_key(pager, right_child);
+
+    unpin_page(pager, right_child_page_num);
+
+    return max_key;
+}
+
+bool
+is_node_root(void* node) {
+    uint8_t value = *((uint8_t*) (node + IS_ROOT_OFFSET));
+
+    return (bool) value;
+}
+
+void
+set_node_root(void* node, bool is_root) {
+    *((uint8_t*) (node + IS_ROOT_OFFSET)) = (uint8_t) is_root;
+}
+
+void
+init_internal_node(void* node) {
+    set_node_type(node, NODE_INTERNAL);
+    set_node_root(node, false);
+    *internal_node_num_keys(node) = 0;
+    *internal_node_right_child(node) = INVALID_PAGE_NUM;
+}
+
+void
+indent(uint32_t level) {
+    for (uint32_t i = 0; i < level; i++) {
+        printf("\t");
+    }
+}
+
+void
+display_tree(Pager* pager, uint32_t page_num, uint32_t indent_level) {
+    void* node = pager_latch(pager, page_num, LATCH_SHARED);
+    uint32_t num_keys, child;
+
+    switch (get_node_type(node)) {
+        case NODE_LEAF:
+            num_keys = *leaf_node_num_cells(node);
+
+            indent(indent_level);
+            printf("leaf.length = %d\n", num_keys);
+
+            for (uint32_t i = 0; i < num_keys; i++) {
+                indent(indent_level + 1);
+                printf("%d\n", *leaf_node_key(node, i));
+            }
+
+            break;
+        case NODE_INTERNAL:
+            num_keys = *internal_node_num_keys(node);
+
+            indent(indent_level);
+            printf("internal.length = %d\n", num_keys);
+
+            for (uint32_t i = 0; i < num_keys; i++) {
+                child = *internal_node_child(node, i);
+
+                display_tree(pager, child, indent_level + 1);
+                indent(indent_level + 1);
+                printf("key: %d\n", *internal_node_key(node, i));
+            }
+
+            child = *internal_node_right_child(node);
+
+            display_tree(pager, child, indent_level + 1);
+
+            break;
+        default:
+            // index pages are never reached from the root of the table
+            break;
+    }
+
+    pager_unlatch(pager, page_num);
+}
+
+uint64_t
+stats_now_ns() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+uint32_t
+latency_bucket(uint64_t ns) {
+    if (ns < LATENCY_SUB_BUCKETS) {
+        return ns;
+    }
+
+    uint32_t exponent = 63 - __builtin_clzll(ns);
+    uint32_t sub_bucket = (ns >> (exponent - LATENCY_SUB_BUCKET_BITS)) - LATENCY_SUB_BUCKETS;
+
+    return (exponent - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS + sub_bucket;
+}
+
+// lowest value of the bucket
+uint64_t
+latency_bucket_value(uint32_t bucket) {
+    if (bucket < LATENCY_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    uint32_t exponent = bucket / LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKET_BITS - 1;
+
+    return (uint64_t) (LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS) << (exponent - LATENCY_SUB_BUCKET_BITS);
+}
+
+void
+latency_record(LatencyHistogram* histogram, uint64_t started_ns) {
+    uint64_t ns = stats_now_ns() - started_ns;
+
+    __atomic_fetch_add(&(histogram->count), 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(histogram->sum_ns), ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(histogram->buckets[latency_bucket(ns)]), 1, __ATOMIC_RELAXED);
+}
+
+// the latency `percentile` (0 to 1) of the recorded ones are under, to the precision of a bucket
+uint64_t
+latency_percentile(LatencyHistogram* histogram, double percentile) {
+    uint64_t total = 0;
+
+    for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+        total += __atomic_load_n(&(histogram->buckets[i]), __ATOMIC_RELAXED);
+    }
+
+    uint64_t target = (uint64_t) (total * percentile);
+    uint64_t seen = 0;
+
+    target = target == 0 ? 1 : target;
+
+    for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += __atomic_load_n(&(histogram->buckets[i]), __ATOMIC_RELAXED);
+
+        if (seen >= target) {
+            return latency_bucket_value(i);
+        }
+    }
+
+    return 0;
+}
+
+// adds the node and its subtree to the stats of their levels, `buffers` holds a page per level. Returns the height of
+// the subtree plus `level`
+uint32_t
+table_level_stats(Snapshot* snapshot, uint32_t page_num, uint32_t level, void** buffers, LevelStats* levels) {
+    void* node = snapshot_read_page(snapshot, page_num, buffers[level]);
+    LevelStats* stats = &(levels[level]);
+
+    stats->num_nodes += 1;
+
+    if (get_node_type(node) == NODE_LEAF) {
+        uint32_t unused = leaf_node_free_space(node) + *leaf_node_fragmented_bytes(node);
+
+        stats->num_keys += *leaf_node_num_cells(node);
+        stats->fill += (double) (PAGE_SIZE - unused) / PAGE_SIZE;
+
+        return level + 1;
+    }
+
+    uint32_t num_keys = *internal_node_num_keys(node);
+    uint32_t height = level + 1;
+
+    stats->num_keys += num_keys;
+    stats->fill += (double) (num_keys + 1) / (INTERNAL_NODE_MAX_KEYS + 1);
+
+    for (uint32_t i = 0; i <= num_keys; i++) {
+        height = table_level_stats(snapshot, *internal_node_child(node, i), level + 1, buffers, levels);
+    }
+
+    return height;
+}
+
+void
+latency_print(FILE* output, const char* name, LatencyHistogram* histogram, bool json) {
+    uint64_t count = __atomic_load_n(&(histogram->count), __ATOMIC_RELAXED);
+    uint64_t mean = count > 0 ? __atomic_load_n(&(histogram->sum_ns), __ATOMIC_RELAXED) / count : 0;
+    double percentiles[] = {0.5, 0.9, 0.99, 0.999, 1};
+    const char* labels[] = {"p50", "p90", "p99", "p999", "max"};
+
+    if (!json) {
+        fprintf(output, "%s: %lu statements, mean %.1f us", name, count, mean / 1e3);
+
+        for (uint32_t i = 0; i < 5; i++) {
+            fprintf(output, ", %s %.1f us", labels[i], latency_percentile(histogram, percentiles[i]) / 1e3);
+        }
+
+        fprintf(output, "\n");
+
+        return;
+    }
+
+    fprintf(output, "\"%s\": {\"count\": %lu, \"mean\": %lu", name, count, mean);
+
+    for (uint32_t i = 0; i < 5; i++) {
+        fprintf(output, ", \"%s\": %lu", labels[i], latency_percentile(histogram, percentiles[i]));
+    }
+
+    // the buckets holding something, as [lowest value, count] pairs
+    fprintf(output, ", \"buckets\": [");
+
+    bool first = true;
+
+    for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+        uint64_t bucket_count = __atomic_load_n(&(histogram->buckets[i]), __ATOMIC_RELAXED);
+
+        if (bucket_count > 0) {
+            fprintf(output, "%s[%lu, %lu]", first ? "" : ", ", latency_bucket_value(i), bucket_count);
+            first = false;
+        }
+    }
+
+    fprintf(output, "]}");
+}
+
+// `.stats` and `.stats json`: the counters of the pager and of the tree, the shape of the tree as of now and the
+// latencies of the statements run since the database was opened
+void
+table_stats_print(Table* table, FILE* output, bool json) {
+    Pager* pager = table->pager;
+
+    pthread_mutex_lock(&(pager->lock));
+
+    uint64_t cache_hits = pager->cache_hits;
+    uint64_t cache_misses = pager->cache_misses;
+    uint64_t pages_read = pager->pages_read;
+    uint64_t pages_written = pager->pages_written;
+    uint64_t pages_evicted = pager->pages_evicted;
+    // NOTE: the mmap pager reads pages straight from the mapping, there are no hits, misses or reads to count
+    bool pool = pager->mode != PAGER_MMAP;
+
+    pthread_mutex_unlock(&(pager->lock));
+
+    uint64_t leaf_splits = __atomic_load_n(&(table->leaf_splits), __ATOMIC_RELAXED);
+    uint64_t internal_splits = __atomic_load_n(&(table->internal_splits), __ATOMIC_RELAXED);
+    Snapshot* snapshot = snapshot_begin(table);
+    void* buffers[BTREE_MAX_HEIGHT + 1];
+    LevelStats levels[BTREE_MAX_HEIGHT + 1];
+
+    memset(levels, 0, sizeof(levels));
+
+    for (uint32_t i = 0; i <= BTREE_MAX_HEIGHT; i++) {
+        buffers[i] = malloc(PAGE_SIZE);
+    }
+
+    uint32_t height = table_level_stats(snapshot, table->root_page_num, 0, buffers, levels);
+
+    for (uint32_t i = 0; i <= BTREE_MAX_HEIGHT; i++) {
+        free(buffers[i]);
+    }
+
+    snapshot_end(snapshot);
+
+    if (json) {
+        if (pool) {
+            fprintf(output, "{\"cache\": {\"hits\": %lu, \"misses\": %lu}, ", cache_hits, cache_misses);
+            fprintf(output, "\"pages\": {\"read\": %lu, \"written\": %lu, \"evicted\": %lu}, ", pages_read,
+                    pages_written, pages_evicted);
+        } else {
+            fprintf(output, "{\"cache\": {\"hits\": null, \"misses\": null}, ");
+            fprintf(output, "\"pages\": {\"read\": null, \"written\": %lu, \"evicted\": null}, ", pages_written);
+        }
+
+        fprintf(output, "\"splits\": {\"leaf\": %lu, \"internal\": %lu}, ", leaf_splits, internal_splits);
+        fprintf(output, "\"tree\": {\"height\": %d, \"levels\": [", height);
+
+        for (uint32_t i = 0; i < height; i++) {
+            fprintf(output, "%s{\"nodes\": %lu, \"keys\": %lu, \"fill\": %.4f}", i == 0 ? "" : ", ",
+                    levels[i].num_nodes, levels[i].num_keys, levels[i].fill / levels[i].num_nodes);
+        }
+
+        fprintf(output, "]}, \"latency_ns\": {");
+        latency_print(output, "insert", &(table->insert_latency), true);
+        fprintf(output, ", ");
+        latency_print(output, "select", &(table->select_latency), true);
+        fprintf(output, "}}\n");
+
+        return;
+    }
+
+    if (pool) {
+        uint64_t lookups = cache_hits + cache_misses;
+
+        fprintf(output, "cache: %lu hits, %lu misses (%.1f%% hit rate)\n", cache_hits, cache_misses,
+                lookups > 0 ? 100.0 * cache_hits / lookups : 0);
+        fprintf(output, "pages: %lu read, %lu written, %lu evicted\n", pages_read, pages_written, pages_evicted);
+    } else {
+        fprintf(output, "cache: n/a, pages are read from the mapping\n");
+        fprintf(output, "pages: n/a read, %lu written, n/a evicted\n", pages_written);
+    }
+
+    fprintf(output, "splits: %lu leaf, %lu internal\n", leaf_splits, internal_splits);
+    fprintf(output, "tree: height %d\n", height);
+
+    for (uint32_t i = 0; i < height; i++) {
+        fprintf(output, "  level %d: %lu nodes, %lu keys, %.1f%% full\n", i, levels[i].num_nodes, levels[i].num_keys,
+                100 * levels[i].fill / levels[i].num_nodes);
+    }
+
+    latency_print(output, "insert", &(table->insert_latency), false);
+    latency_print(output, "select", &(table->select_latency), false);
+}
+
+// number of keys lower than `key` among the first `num_keys`
+uint32_t
+count_keys_below_scalar(const uint32_t* keys, uint32_t num_keys, uint32_t key) {
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < num_keys; i++) {
+        count += keys[i] < key;
+    }
+
+    return count;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// NOTE: there's no unsigned 32-bit compare before AVX-512, flipping the sign bit of both sides turns the signed compare
+// into an unsigned one
+__attribute__((target("sse2"))) uint32_t
+count_keys_below_sse2(const uint32_t* keys, uint32_t num_keys, uint32_t key) {
+    __m128i sign = _mm_set1_epi32(INT32_MIN);
+    __m128i search = _mm_xor_si128(_mm_set1_epi32(key), sign);
+    uint32_t count = 0;
+    uint32_t i = 0;
+
+    for (; i + 4 <= num_keys; i += 4) {
+        __m128i block = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (keys + i)), sign);
+
+        count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(search, block))));
+    }
+
+    return count + count_keys_below_scalar(keys + i, num_keys - i, key);
+}
+
+__attribute__((target("avx2"))) uint32_t
+count_keys_below_avx2(const uint32_t* keys, uint32_t num_keys, uint32_t key) {
+    __m256i sign = _mm256_set1_epi32(INT32_MIN);
+    __m256i search = _mm256_xor_si256(_mm256_set1_epi32(key), sign);
+    uint32_t count = 0;
+    uint32_t i = 0;
+
+    for (; i + 8 <= num_keys; i += 8) {
+        __m256i block = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) (keys + i)), sign);
+
+        count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(search, block))));
+    }
+
+    return count + count_keys_below_scalar(keys + i, num_keys - i, key);
+}
+#endif
+
+uint32_t (*count_keys_below)(const uint32_t* keys, uint32_t num_keys, uint32_t key) = count_keys_below_scalar;
+pthread_once_t count_keys_below_once = PTHREAD_ONCE_INIT;
+
+// picks the widest compare the cpu supports, once
+void
+count_keys_below_init() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        count_keys_below = count_keys_below_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        count_keys_below = count_keys_below_sse2;
+    }
+#endif
+}
+
+// index of the child whose subtree holds `key`, the first key greater or equal to it, or the right child. A branchless
+// binary search narrows the keys down to a window, then the keys below `key` inside it are counted, since the keys
+// are sorted that count is the index
+uint32_t
+internal_node_find_child(void* node, uint32_t key) {
+    const uint32_t* keys = internal_node_keys(node);
+    const uint32_t* base = keys;
+    uint32_t length = *internal_node_num_keys(node);
+
+    pthread_once(&count_keys_below_once, count_keys_below_init);
+
+    while (length > INTERNAL_NODE_SEARCH_WINDOW) {
+        uint32_t half = length / 2;
+
+        base = base[half - 1] < key ? base + half : base;
+        length -= half;
+    }
+
+    return (base - keys) + count_keys_below(base, length, key);
+}
+
+// latches a node reached by a descent, internal nodes in `inner_mode` and leaves in `leaf_mode`. The type is only known
+// once the page is latched, so a leaf may have to be latched again. Returns NULL when the node stopped being a leaf in
+// between, which only happens to the root, every other node stays what it is while its parent is latched
+void*
+node_latch(Pager* pager, uint32_t page_num, LatchMode inner_mode, LatchMode leaf_mode) {
+    void* node = pager_latch(pager, page_num, inner_mode);
+
+    if (inner_mode == leaf_mode || get_node_type(node) != NODE_LEAF) {
+        return node;
+    }
+
+    pager_unlatch(pager, page_num);
+    node = pager_latch(pager, page_num, leaf_mode);
+
+    if (get_node_type(node) != NODE_LEAF) {
+        pager_unlatch(pager, page_num);
+        return NULL;
+    }
+
+    return node;
+}
+
+// latch crabbing from the root down to the leaf holding `key`: the child is latched before its parent is let go, so
+// no split can run between the two. A shared descent drops the parent right away, an exclusive one keeps the
+// ancestors until it reaches a node that can't split, then lets go of every ancestor above it
+void
+internal_node_find(Table* table, Cursor* cursor, uint32_t key, LatchMode inner_mode, LatchMode leaf_mode) {
+    Pager* pager = table->pager;
+    uint32_t page_num = table->root_page_num;
+    void* node = node_latch(pager, page_num, inner_mode, leaf_mode);
+
+    while (node == NULL) {
+        node = node_latch(pager, page_num, inner_mode, leaf_mode);
+    }
+
+    cursor->depth = 0;
+    cursor->latch_depth = 0;
+
+    while (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t child_page_num = *internal_node_child(node, internal_node_find_child(node, key));
+        void* child = node_latch(pager, child_page_num, inner_mode, leaf_mode);
+
+        cursor->path[cursor->depth++] = page_num;
+
+        if (inner_mode == LATCH_SHARED || is_node_safe(child)) {
+            cursor_release_ancestors(cursor);
+        }
+
+        page_num = child_page_num;
+        node = child;
+    }
+
+    cursor->page_num = page_num;
+    cursor->node = node;
+    leaf_node_find(cursor, key);
+}
+
+// NOTE: the caller holds the writer lock of the table for the whole load
+BulkLoader*
+bulk_load_begin(Table* table, uint32_t fill_percent) {
+    void* root = pager_latch(table->pager, table->root_page_num, LATCH_SHARED);
+    bool is_empty = get_node_type(root) == NODE_LEAF && *leaf_node_num_cells(root) == 0;
+
+    pager_unlatch(table->pager, table->root_page_num);
+
+    if (!is_empty) {
+        return NULL;
+    }
+
+    BulkLoader* loader = malloc(sizeof(BulkLoader));
+
+    loader->table = table;
+    loader->leaf_capacity = LEAF_NODE_SPACE_FOR_CELLS * fill_percent / 100;
+    loader->internal_capacity = (INTERNAL_NODE_MAX_KEYS + 1) * fill_percent / 100;
+    loader->leaf_page_num = INVALID_PAGE_NUM;
+    loader->leaf = NULL;
+    loader->num_rows = 0;
+    loader->last_key = 0;
+    loader->txn_pages = 0;
+    loader->level_count = 0;
+    loader->level_capacity = 0;
+    loader->level_keys = NULL;
+    loader->level_pages = NULL;
+    loader->level_rows = NULL;
+
+    if (loader->internal_capacity < 2) {
+        loader->internal_capacity = 2;
+    }
+
+    pager_begin(table->pager);
+
+    return loader;
+}
+
+void
+bulk_load_push_node(BulkLoader* loader, uint32_t max_key, uint32_t page_num, uint32_t num_rows) {
+    if (loader->level_count == loader->level_capacity) {
+        loader->level_capacity = loader->level_capacity == 0 ? 1024 : loader->level_capacity * 2;
+        loader->level_keys = realloc(loader->level_keys, loader->level_capacity * sizeof(uint32_t));
+        loader->level_pages = realloc(loader->level_pages, loader->level_capacity * sizeof(uint32_t));
+        loader->level_rows = realloc(loader->level_rows, loader->level_capacity * sizeof(uint32_t));
+    }
+
+    loader->level_keys[loader->level_count] = max_key;
+    loader->level_pages[loader->level_count] = page_num;
+    loader->level_rows[loader->level_count] = num_rows;
+    loader->level_count += 1;
+}
+
+// commits every BULK_LOAD_TXN_PAGES built pages, so the pinned pages of the transaction never outgrow the cache. The
+// pages aren't reachable from the root until bulk_load_finish, a crash halfway leaves the table empty
+void
+bulk_load_page_built(BulkLoader* loader) {
+    Pager* pager = loader->table->pager;
+
+    loader->txn_pages += 1;
+
+    if (loader->txn_pages >= BULK_LOAD_TXN_PAGES) {
+        pager_commit(pager);
+        pager_maybe_flush(pager);
+        pager_begin(pager);
+        loader->txn_pages = 0;
+    }
+}
+
+void
+bulk_load_close_leaf(BulkLoader* loader) {
+    uint32_t max_key = *leaf_node_key(loader->leaf, *leaf_node_num_cells(loader->leaf) - 1);
+
+    bulk_load_push_node(loader, max_key, loader->leaf_page_num, *leaf_node_num_cells(loader->leaf));
+    bloom_add_leaf(loader->table, loader->leaf_page_num, loader->leaf);
+    unpin_page(loader->table->pager, loader->leaf_page_num);
+    loader->leaf = NULL;
+    bulk_load_page_built(loader);
+}
+
+ExecuteResult
+bulk_load_add(BulkLoader* loader, Row* row) {
+    Pager* pager = loader->table->pager;
+
+    if (loader->num_rows > 0 && row->id <= loader->last_key) {
+        return row->id == loader->last_key ? EXEC_DUPLICATE_KEY : EXEC_UNSORTED_KEY;
+    }
+
+    uint32_t cell_size = LEAF_NODE_CELL_OVERHEAD + row_serialized_size(row);
+
+    // a leaf takes cells up to its fill factor, but always at least one
+    if (loader->leaf == NULL ||
+        (*leaf_node_num_cells(loader->leaf) > 0 &&
+         LEAF_NODE_SPACE_FOR_CELLS - leaf_node_free_space(loader->leaf) + cell_size > loader->leaf_capacity)) {
+        // pages are handed out in order, so the leaves end up next to each other in the file
+        uint32_t page_num = get_unused_page_num(pager);
+
+        if (loader->leaf != NULL) {
+            *leaf_node_next_leaf(loader->leaf) = page_num;
+            bulk_load_close_leaf(loader);
+        }
+
+        loader->leaf_page_num = page_num;
+        loader->leaf = get_page(pager, page_num);
+        pager_mark_dirty(pager, page_num);
+        init_leaf_node(loader->leaf);
+    }
+
+    leaf_node_put_row(loader->leaf, *leaf_node_num_cells(loader->leaf), row->id, row);
+
+    loader->last_key = row->id;
+    loader->num_rows += 1;
+
+    return EXEC_RES_SUCCESS;
+}
+
+void
+bulk_load_finish(BulkLoader* loader) {
+    Table* table = loader->table;
+    Pager* pager = table->pager;
+
+    if (loader->leaf != NULL) {
+        bulk_load_close_leaf(loader);
+    }
+
+    // every pass groups the nodes of a level under the internal nodes of the next one, spreading the children evenly
+    while (loader->level_count > 1) {
+        uint32_t count = loader->level_count;
+        uint32_t num_nodes = (count + loader->internal_capacity - 1) / loader->internal_capacity;
+        uint32_t child = 0;
+
+        loader->level_count = 0;
+
+        for (uint32_t i = 0; i < num_nodes; i++) {
+            uint32_t num_children = count / num_nodes + (i < count % num_nodes ? 1 : 0);
+            uint32_t page_num = num_nodes == 1 ? table->root_page_num : get_unused_page_num(pager);
+            void* node = pager_latch(pager, page_num, LATCH_EXCLUSIVE);
+
+            pager_mark_dirty(pager, page_num);
+            init_internal_node(node);
+            *internal_node_num_keys(node) = num_children - 1;
+
+            uint32_t num_rows = 0;
+
+            for (uint32_t j = 0; j < num_children - 1; j++) {
+                *internal_node_child(node, j) = loader->level_pages[child + j];
+                *internal_node_key(node, j) = loader->level_keys[child + j];
+            }
+
+            for (uint32_t j = 0; j < num_children; j++) {
+                *internal_node_count(node, j) = loader->level_rows[child + j];
+                num_rows += loader->level_rows[child + j];
+            }
+
+            *internal_node_right_child(node) = loader->level_pages[child + num_children - 1];
+
+            // NOTE: the level arrays are rewritten in place, entry i is only written after its children were read
+            uint32_t max_key = loader->level_keys[child + num_children - 1];
+
+            child += num_children;
+            bulk_load_push_node(loader, max_key, page_num, num_rows);
+            pager_unlatch(pager, page_num);
+            bulk_load_page_built(loader);
+        }
+    }
+
+    // the new tree is built out of pages no reader can reach, it shows up all at once when the root changes
+    void* root = pager_latch(pager, table->root_page_num, LATCH_EXCLUSIVE);
+
+    pager_mark_dirty(pager, table->root_page_num);
+
+    // a single leaf is the whole tree, it takes the place of the root
+    if (loader->level_count == 1 && loader->level_pages[0] != table->root_page_num) {
+        void* leaf = get_page(pager, loader->level_pages[0]);
+        uint32_t catalog_page_num = *root_node_catalog(root);
+
+        memcpy(root, leaf, PAGE_SIZE);
+        *root_node_catalog(root) = catalog_page_num;
+        unpin_page(pager, loader->level_pages[0]);
+    }
+
+    set_node_root(root, true);
+    pager_unlatch(pager, table->root_page_num);
+
+    pager_commit(pager);
+    pager_maybe_flush(pager);
+
+    free(loader->level_keys);
+    free(loader->level_pages);
+    free(loader->level_rows);
+    free(loader);
+}
+
+// parses a `<id> <name> <email>` line of a load file
+bool
+load_parse_line(char* line, Row* row) {
+    line[strcspn(line, "\r\n")] = 0;
+
+    if (line[0] == 0) {
+        return false;
+    }
+
+    char* save;
+    char* row_id_str = strtok_r(line, " ", &save);
+    char* username = strtok_r(NULL, " ", &save);
+    char* email = strtok_r(NULL, " ", &save);
+
+    return parse_row(row_id_str, username, email, row) == PREP_SUCCESS;
+}
+
+int
+compare_row_id(const void* a, const void* b) {
+    uint32_t id_a = ((const Row*) a)->id;
+    uint32_t id_b = ((const Row*) b)->id;
+
+    return (id_a > id_b) - (id_a < id_b);
+}
+
+// a spilled sort run, read back in chunks of BULK_LOAD_MERGE_ROWS rows while merging
+typedef struct {
+    off_t offset;  // file offset of the next row not buffered yet
+    uint32_t remaining;  // rows of the run not buffered yet
+    uint32_t buffered;
+    uint32_t position;
+    Row* rows;
+} LoadRun;
+
+// points row at the next row of the run, refilling its merge buffer when empty
+bool
+load_run_peek(int fd, LoadRun* run, Row** row) {
+    if (run->position == run->buffered) {
+        if (run->remaining == 0) {
+            return false;
+        }
+
+        uint32_t count = run->remaining < BULK_LOAD_MERGE_ROWS ? run->remaining : BULK_LOAD_MERGE_ROWS;
+
+        if (pread(fd, run->rows, count * sizeof(Row), run->offset) != (ssize_t) (count * sizeof(Row))) {
+            printf("error reading sort run: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+
+        run->offset += count * sizeof(Row);
+        run->remaining -= count;
+        run->buffered = count;
+        run->position = 0;
+    }
+
+    *row = &(run->rows[run->position]);
+
+    return true;
+}
+
+void
+load_heap_sift_down(uint32_t* heap, uint32_t count, uint32_t position, Row** heads) {
+    while (true) {
+        uint32_t smallest = position;
+        uint32_t left = 2 * position + 1;
+        uint32_t right = left + 1;
+
+        if (left < count && heads[heap[left]]->id < heads[heap[smallest]]->id) {
+            smallest = left;
+        }
+
+        if (right < count && heads[heap[right]]->id < heads[heap[smallest]]->id) {
+            smallest = right;
+        }
+
+        if (smallest == position) {
+            return;
+        }
+
+        uint32_t swap = heap[position];
+
+        heap[position] = heap[smallest];
+        heap[smallest] = swap;
+        position = smallest;
+    }
+}
+
+// external merge sort for input that isn't in key order: sorted runs of BULK_LOAD_RUN_ROWS rows are spilled to a
+// temporary file, then a heap merges all of them into the loader
+ExecuteResult
+load_sorted_runs(BulkLoader* loader, FILE* input, Row* run_rows) {
+    FILE* spill = tmpfile();
+
+    if (spill == NULL) {
+        printf("unable to create a temporary file for sorting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int fd = fileno(spill);
+    uint32_t num_runs = 0;
+    uint32_t* run_lengths = NULL;
+    char* line = NULL;
+    size_t line_capacity = 0;
+    bool more = true;
+    off_t spilled = 0;
+
+    while (more) {
+        uint32_t count = 0;
+
+        while (count < BULK_LOAD_RUN_ROWS) {
+            if (getline(&line, &line_capacity, input) == -1) {
+                more = false;
+                break;
+            }
+
+            if (load_parse_line(line, &(run_rows[count]))) {
+                count++;
+            }
+        }
+
+        if (count == 0) {
+            break;
+        }
+
+        qsort(run_rows, count, sizeof(Row), compare_row_id);
+
+        if (pwrite(fd, run_rows, count * sizeof(Row), spilled) != (ssize_t) (count * sizeof(Row))) {
+            printf("error writing sort run: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+
+        spilled += count * sizeof(Row);
+        run_lengths = realloc(run_lengths, (num_runs + 1) * sizeof(uint32_t));
+        run_lengths[num_runs++] = count;
+    }
+
+    free(line);
+
+    // the run buffer is no longer needed, it now holds the merge buffers of every run
+    LoadRun* runs = malloc(num_runs * sizeof(LoadRun));
+    Row** heads = malloc(num_runs * sizeof(Row*));
+    uint32_t* heap = malloc(num_runs * sizeof(uint32_t));
+    uint32_t heap_count = 0;
+    off_t offset = 0;
+    Row* merge_rows = num_runs * BULK_LOAD_MERGE_ROWS <= BULK_LOAD_RUN_ROWS
+        ? run_rows
+        : malloc((size_t) num_runs * BULK_LOAD_MERGE_ROWS * sizeof(Row));
+
+    for (uint32_t i = 0; i < num_runs; i++) {
+        runs[i].offset = offset;
+        runs[i].remaining = run_lengths[i];
+        runs[i].buffered = 0;
+        runs[i].position = 0;
+        runs[i].rows = merge_rows + (size_t) i * BULK_LOAD_MERGE_ROWS;
+        offset += (off_t) run_lengths[i] * sizeof(Row);
+
+        if (load_run_peek(fd, &(runs[i]), &(heads[i]))) {
+            heap[heap_count++] = i;
+        }
+    }
+
+    for (int32_t i = (int32_t) heap_count / 2 - 1; i >= 0; i--) {
+        load_heap_sift_down(heap, heap_count, i, heads);
+    }
+
+    ExecuteResult result = EXEC_RES_SUCCESS;
+
+    while (heap_count > 0 && result == EXEC_RES_SUCCESS) {
+        uint32_t run = heap[0];
+
+        result = bulk_load_add(loader, heads[run]);
+        runs[run].position += 1;
+
+        if (!load_run_peek(fd, &(runs[run]), &(heads[run]))) {
+            heap[0] = heap[--heap_count];
+        }
+
+        load_heap_sift_down(heap, heap_count, 0, heads);
+    }
+
+    if (merge_rows != run_rows) {
+        free(merge_rows);
+    }
+
+    free(heap);
+    free(heads);
+    free(runs);
+    free(run_lengths);
+    fclose(spill);
+
+    return result;
+}
+
+// loads `<id> <name> <email>` lines into an empty table. Input already in key order is streamed straight into the
+// loader, anything else goes through an external merge sort first
+ExecuteResult
+table_load_file(Table* table, const char* filename, uint32_t fill_percent, uint32_t* num_rows) {
+    FILE* input = fopen(filename, "r");
+
+    if (input == NULL) {
+        printf("unable to open %s\n", filename);
+        return EXEC_BAD_INPUT;
+    }
+
+    // first pass, validates every line and finds out whether the input is sorted
+    char* line = NULL;
+    size_t line_capacity = 0;
+    uint32_t line_num = 0;
+    bool sorted = true;
+    bool has_rows = false;
+    uint32_t last_key = 0;
+    Row row;
+
+    while (getline(&line, &line_capacity, input) != -1) {
+        line_num++;
+
+        if (line[strspn(line, " \r\n")] == 0) {
+            continue;
+        }
+
+        if (!load_parse_line(line, &row)) {
+            printf("ERR: %s:%d is not a valid row\n", filename, line_num);
+            free(line);
+            fclose(input);
+
+            return EXEC_BAD_INPUT;
+        }
+
+        if (has_rows && row.id <= last_key) {
+            sorted = false;
+        }
+
+        has_rows = true;
+        last_key = row.id;
+    }
+
+    rewind(input);
+    pthread_mutex_lock(&(table->writer_lock));
+
+    BulkLoader* loader = bulk_load_begin(table, fill_percent);
+
+    if (loader == NULL) {
+        pthread_mutex_unlock(&(table->writer_lock));
+        free(line);
+        fclose(input);
+
+        return EXEC_TABLE_NOT_EMPTY;
+    }
+
+    ExecuteResult result = EXEC_RES_SUCCESS;
+
+    if (sorted) {
+        while (result == EXEC_RES_SUCCESS && getline(&line, &line_capacity, input) != -1) {
+            if (load_parse_line(line, &row)) {
+                result = bulk_load_add(loader, &row);
+            }
+        }
+    } else {
+        Row* run_rows = malloc(BULK_LOAD_RUN_ROWS * sizeof(Row));
+
+        result = load_sorted_runs(loader, input, run_rows);
+        free(run_rows);
+    }
+
+    *num_rows = loader->num_rows;
+
+    free(line);
+    fclose(input);
+
+    // NOTE: on a duplicated key the rows loaded so far are kept, like a run of inserts stopping at the first error
+    bulk_load_finish(loader);
+
+    // the indexes were as empty as the table, the loaded rows are inserted into them the way an index build does
+    for (uint32_t i = 0; i < table->num_indexes; i++) {
+        pager_begin(table->pager);
+        index_fill(table, &(table->indexes[i]));
+        pager_commit(table->pager);
+        pager_maybe_flush(table->pager);
+    }
+    pthread_mutex_unlock(&(table->writer_lock));
+
+    return result;
+}
+
+uint16_t*
+index_node_num_cells(void* node) {
+    return node + INDEX_NODE_NUM_CELLS_OFFSET;
+}
+
+uint8_t*
+index_node_prefix_length(void* node) {
+    return node + INDEX_NODE_PREFIX_LENGTH_OFFSET;
+}
+
+uint8_t*
+index_node_prefix(void* node) {
+    return node + INDEX_NODE_HEADER_SIZE;
+}
+
+uint32_t*
+index_node_link(void* node) {
+    return node + INDEX_NODE_LINK_OFFSET;
+}
+
+uint16_t*
+index_node_slot(void* node, uint32_t cell_num) {
+    return node + INDEX_NODE_HEADER_SIZE + *index_node_prefix_length(node) + cell_num * INDEX_NODE_SLOT_SIZE;
+}
+
+uint8_t*
+index_node_cell(void* node, uint32_t cell_num) {
+    return node + *index_node_slot(node, cell_num);
+}
+
+uint32_t
+index_cell_id(const uint8_t* cell) {
+    uint32_t id;
+
+    memcpy(&id, cell + INDEX_CELL_SUFFIX_LENGTH_SIZE + cell[0], INDEX_CELL_ID_SIZE);
+
+    return id;
+}
+
+uint32_t
+index_cell_child(const uint8_t* cell) {
+    uint32_t child;
+
+    memcpy(&child, cell + INDEX_CELL_SUFFIX_LENGTH_SIZE + cell[0] + INDEX_CELL_ID_SIZE, INDEX_CELL_CHILD_SIZE);
+
+    return child;
+}
+
+// the child of an internal node at a position found by index_node_lower_bound, past the last cell is the right child
+uint32_t
+index_node_child(void* node, uint32_t position) {
+    if (position < *index_node_num_cells(node)) {
+        return index_cell_child(index_node_cell(node, position));
+    }
+
+    return *index_node_link(node);
 }
 
 void
-display_constants() {
-    printf("row size: %d\n"
-           "common node header size: %d\n"
-           "leaf node header size: %d\n"
-           "leaf node cell size: %d\n"
-           "leaf node space for cells: %d\n"
-           "leaf node max cells: %d\n",
-           ROW_SIZE,
-           COMMON_NODE_HEADER_SIZE,
-           LEAF_NODE_HEADER_SIZE,
-           LEAF_NODE_CELL_SIZE,
-           LEAF_NODE_SPACE_FOR_CELLS,
-           LEAF_NODE_MAX_CELLS);
+init_index_node(void* node, NodeType type) {
+    set_node_type(node, type);
+    set_node_root(node, false);
+    *index_node_num_cells(node) = 0;
+    *index_node_prefix_length(node) = 0;
+    *index_node_link(node) = INVALID_PAGE_NUM;
+}
+
+// orders (value, id) pairs, values compare bytewise and a value comes before the longer ones it's a prefix of
+int
+index_key_compare(
+    const uint8_t* a, uint32_t a_length, uint32_t a_id, const uint8_t* b, uint32_t b_length, uint32_t b_id) {
+    int result = memcmp(a, b, a_length < b_length ? a_length : b_length);
+
+    if (result != 0) {
+        return result;
+    }
+
+    if (a_length != b_length) {
+        return a_length < b_length ? -1 : 1;
+    }
+
+    return a_id < b_id ? -1 : a_id > b_id;
+}
+
+// first cell of the node not lower than (key, id). A key that doesn't start with the prefix of the node is lower or
+// greater than every cell, only the suffixes are compared otherwise
+uint32_t
+index_node_lower_bound(void* node, const uint8_t* key, uint32_t length, uint32_t id) {
+    uint32_t num_cells = *index_node_num_cells(node);
+    uint32_t prefix_length = *index_node_prefix_length(node);
+    int result = memcmp(key, index_node_prefix(node), length < prefix_length ? length : prefix_length);
+
+    if (result != 0) {
+        return result < 0 ? 0 : num_cells;
+    }
+
+    if (length < prefix_length) {
+        return 0;
+    }
+
+    uint32_t low = 0;
+    uint32_t high = num_cells;
+
+    while (low < high) {
+        uint32_t middle = (low + high) / 2;
+        const uint8_t* cell = index_node_cell(node, middle);
+
+        if (index_key_compare(cell + INDEX_CELL_SUFFIX_LENGTH_SIZE, cell[0], index_cell_id(cell), key + prefix_length,
+                              length - prefix_length, id) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+// whether the value of the cell is `key`, whatever its id
+bool
+index_cell_matches(void* node, uint32_t cell_num, const uint8_t* key, uint32_t length) {
+    uint32_t prefix_length = *index_node_prefix_length(node);
+    const uint8_t* cell = index_node_cell(node, cell_num);
+
+    return prefix_length + cell[0] == length && memcmp(index_node_prefix(node), key, prefix_length) == 0 &&
+           memcmp(cell + INDEX_CELL_SUFFIX_LENGTH_SIZE, key + prefix_length, cell[0]) == 0;
+}
+
+// the entries are sorted, whatever the first and the last one have in common the ones between them have too
+uint32_t
+index_common_prefix(IndexEntry* entries, uint32_t count) {
+    if (count == 0) {
+        return 0;
+    }
+
+    IndexEntry* first = &(entries[0]);
+    IndexEntry* last = &(entries[count - 1]);
+    uint32_t length = first->length < last->length ? first->length : last->length;
+    uint32_t prefix_length = 0;
+
+    while (prefix_length < length && first->key[prefix_length] == last->key[prefix_length]) {
+        prefix_length++;
+    }
+
+    return prefix_length;
+}
+
+// bytes a node made of the entries takes
+uint32_t
+index_node_size(IndexEntry* entries, uint32_t count, bool internal) {
+    uint32_t prefix_length = index_common_prefix(entries, count);
+    uint32_t cell_overhead = INDEX_NODE_SLOT_SIZE + INDEX_CELL_SUFFIX_LENGTH_SIZE + INDEX_CELL_ID_SIZE +
+                             (internal ? INDEX_CELL_CHILD_SIZE : 0);
+    uint32_t size = INDEX_NODE_HEADER_SIZE + prefix_length;
+
+    for (uint32_t i = 0; i < count; i++) {
+        size += cell_overhead + entries[i].length - prefix_length;
+    }
+
+    return size;
+}
+
+// spells out the keys of the cells in full. Returns how many cells the node has
+uint32_t
+index_node_read(void* node, IndexEntry* entries) {
+    uint32_t num_cells = *index_node_num_cells(node);
+    uint32_t prefix_length = *index_node_prefix_length(node);
+    bool internal = get_node_type(node) == NODE_INDEX_INTERNAL;
+
+    for (uint32_t i = 0; i < num_cells; i++) {
+        const uint8_t* cell = index_node_cell(node, i);
+
+        entries[i].length = prefix_length + cell[0];
+        memcpy(entries[i].key, index_node_prefix(node), prefix_length);
+        memcpy(entries[i].key + prefix_length, cell + INDEX_CELL_SUFFIX_LENGTH_SIZE, cell[0]);
+        entries[i].id = index_cell_id(cell);
+        entries[i].child = internal ? index_cell_child(cell) : INVALID_PAGE_NUM;
+    }
+
+    return num_cells;
+}
+
+// rewrites the cells of the node out of the entries, with the longest prefix they share. The header keeps its type
+// and its link, the entries have to fit
+void
+index_node_write(void* node, IndexEntry* entries, uint32_t count) {
+    uint32_t prefix_length = index_common_prefix(entries, count);
+    bool internal = get_node_type(node) == NODE_INDEX_INTERNAL;
+    uint32_t content_start = PAGE_SIZE;
+
+    *index_node_num_cells(node) = count;
+    *index_node_prefix_length(node) = prefix_length;
+    memcpy(index_node_prefix(node), entries[0].key, prefix_length);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t suffix_length = entries[i].length - prefix_length;
+
+        content_start -= INDEX_CELL_SUFFIX_LENGTH_SIZE + suffix_length + INDEX_CELL_ID_SIZE;
+        content_start -= internal ? INDEX_CELL_CHILD_SIZE : 0;
+        *index_node_slot(node, i) = content_start;
+
+        uint8_t* cell = node + content_start;
+
+        cell[0] = suffix_length;
+        memcpy(cell + INDEX_CELL_SUFFIX_LENGTH_SIZE, entries[i].key + prefix_length, suffix_length);
+        memcpy(cell + INDEX_CELL_SUFFIX_LENGTH_SIZE + suffix_length, &(entries[i].id), INDEX_CELL_ID_SIZE);
+
+        if (internal) {
+            memcpy(cell + INDEX_CELL_SUFFIX_LENGTH_SIZE + suffix_length + INDEX_CELL_ID_SIZE, &(entries[i].child),
+                   INDEX_CELL_CHILD_SIZE);
+        }
+    }
+}
+
+// how many entries go to the left half of a split, about half of the bytes of the cells. The halves share at least
+// the prefix of the whole node, so both of them fit
+uint32_t
+index_split_point(IndexEntry* entries, uint32_t count, bool internal) {
+    uint32_t prefix_length = index_common_prefix(entries, count);
+    uint32_t total = index_node_size(entries, count, internal);
+    uint32_t size = INDEX_NODE_HEADER_SIZE + prefix_length;
+    uint32_t split = 0;
+
+    while (split < count - 1 && size < total / 2) {
+        size += INDEX_NODE_SLOT_SIZE + INDEX_CELL_SUFFIX_LENGTH_SIZE + INDEX_CELL_ID_SIZE + entries[split].length -
+                prefix_length + (internal ? INDEX_CELL_CHILD_SIZE : 0);
+        split++;
+    }
+
+    // an internal node moves its last left entry up, the left half keeps at least one other
+    return split < 2 ? 2 : split;
+}
+
+// adds (key, id) to the index, called by the writer inside its transaction. The writer is alone changing the index
+// and readers only latch one page at a time, so it keeps the whole path latched. A node that overflows splits in two,
+// the greatest key of the left half goes up as the separator, a full root moves both halves to new pages and stays
+// in place
+void
+index_insert(Table* table, Index* index, const uint8_t* key, uint32_t length, uint32_t id) {
+    Pager* pager = table->pager;
+    IndexEntry* entries = index->entries;
+    uint32_t path[BTREE_MAX_HEIGHT + 1];
+    uint32_t positions[BTREE_MAX_HEIGHT];  // cell of every internal node the descent followed
+    void* nodes[BTREE_MAX_HEIGHT + 1];
+    uint32_t depth = 0;
+
+    path[0] = index->root_page_num;
+    nodes[0] = pager_latch(pager, path[0], LATCH_EXCLUSIVE);
+
+    while (get_node_type(nodes[depth]) == NODE_INDEX_INTERNAL) {
+        void* node = nodes[depth];
+        uint32_t position = index_node_lower_bound(node, key, length, id);
+
+        positions[depth] = position;
+        path[depth + 1] = index_node_child(node, position);
+        nodes[depth + 1] = pager_latch(pager, path[depth + 1], LATCH_EXCLUSIVE);
+        depth++;
+    }
+
+    uint32_t latched = depth + 1;
+    uint32_t position = index_node_lower_bound(nodes[depth], key, length, id);
+    uint32_t count = index_node_read(nodes[depth], entries);
+
+    memmove(&(entries[position + 1]), &(entries[position]), (count - position) * sizeof(IndexEntry));
+    entries[position].length = length;
+    memcpy(entries[position].key, key, length);
+    entries[position].id = id;
+    entries[position].child = INVALID_PAGE_NUM;
+    count++;
+
+    while (true) {
+        uint32_t page_num = path[depth];
+        void* node = nodes[depth];
+        NodeType type = get_node_type(node);
+        bool internal = type == NODE_INDEX_INTERNAL;
+
+        pager_mark_dirty(pager, page_num);
+
+        if (index_node_size(entries, count, internal) <= PAGE_SIZE) {
+            index_node_write(node, entries, count);
+            break;
+        }
+
+        uint32_t split = index_split_point(entries, count, internal);
+        IndexEntry separator = entries[split - 1];
+        uint32_t right_page_num = get_unused_page_num(pager);
+        void* right = pager_latch(pager, right_page_num, LATCH_EXCLUSIVE);
+
+        pager_mark_dirty(pager, right_page_num);
+        init_index_node(right, type);
+        *index_node_link(right) = *index_node_link(node);
+        index_node_write(right, &(entries[split]), count - split);
+        pager_unlatch(pager, right_page_num);
+
+        uint32_t left_page_num = page_num;
+        void* left = node;
+
+        if (is_node_root(node)) {
+            left_page_num = get_unused_page_num(pager);
+            left = pager_latch(pager, left_page_num, LATCH_EXCLUSIVE);
+            pager_mark_dirty(pager, left_page_num);
+            init_index_node(left, type);
+        }
+
+        // the right child of the left half of an internal node is the child of the separator
+        *index_node_link(left) = internal ? separator.child : right_page_num;
+        index_node_write(left, entries, internal ? split - 1 : split);
+
+        if (left != node) {
+            pager_unlatch(pager, left_page_num);
+
+            separator.child = left_page_num;
+            init_index_node(node, NODE_INDEX_INTERNAL);
+            set_node_root(node, true);
+            *index_node_link(node) = right_page_num;
+            index_node_write(node, &separator, 1);
+            break;
+        }
+
+        // the cell of the parent that led to the node now leads to its right half, the separator goes right before it
+        depth--;
+        position = positions[depth];
+        count = index_node_read(nodes[depth], entries);
+
+        if (position < count) {
+            entries[position].child = right_page_num;
+        } else {
+            pager_mark_dirty(pager, path[depth]);
+            *index_node_link(nodes[depth]) = right_page_num;
+        }
+
+        memmove(&(entries[position + 1]), &(entries[position]), (count - position) * sizeof(IndexEntry));
+        separator.child = left_page_num;
+        entries[position] = separator;
+        count++;
+    }
+
+    for (uint32_t i = 0; i < latched; i++) {
+        pager_unlatch(pager, path[i]);
+    }
+}
+
+// the ids of the rows whose column holds `key` as the snapshot sees them, in id order. Returns how many there are,
+// `ids` is malloc'd
+uint32_t
+index_lookup(Snapshot* snapshot, Index* index, const uint8_t* key, uint32_t length, uint32_t** ids) {
+    uint8_t buffer[PAGE_SIZE];
+    void* node = snapshot_read_page(snapshot, index->root_page_num, buffer);
+    uint32_t num_ids = 0;
+    uint32_t capacity = 0;
+
+    while (get_node_type(node) == NODE_INDEX_INTERNAL) {
+        uint32_t position = index_node_lower_bound(node, key, length, 0);
+        node = snapshot_read_page(snapshot, index_node_child(node, position), buffer);
+    }
+
+    *ids = NULL;
+
+    // the matching cells may go on in the next leaves
+    for (uint32_t cell_num = index_node_lower_bound(node, key, length, 0);; cell_num++) {
+        if (cell_num == *index_node_num_cells(node)) {
+            if (*index_node_link(node) == INVALID_PAGE_NUM) {
+                break;
+            }
+
+            node = snapshot_read_page(snapshot, *index_node_link(node), buffer);
+            cell_num = 0;
+
+            if (*index_node_num_cells(node) == 0) {
+                break;
+            }
+        }
+
+        if (!index_cell_matches(node, cell_num, key, length)) {
+            break;
+        }
+
+        if (num_ids == capacity) {
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            *ids = realloc(*ids, capacity * sizeof(uint32_t));
+        }
+
+        (*ids)[num_ids++] = index_cell_id(index_node_cell(node, cell_num));
+    }
+
+    return num_ids;
+}
+
+// inserts every row of the table into the index, called by the writer inside a transaction. The transaction is
+// committed along the way to keep it small, the index only shows up once it's in the catalog. Returns the number of
+// rows
+uint64_t
+index_fill(Table* table, Index* index) {
+    Pager* pager = table->pager;
+    Cursor* cursor = table_start(table);
+    uint64_t num_rows = 0;
+
+    while (!(cursor->end_of_table)) {
+        void* payload = cursor_value(cursor);
+        uint32_t id;
+        uint32_t length;
+        const uint8_t* value = row_payload_column(payload, index->column, &length);
+
+        memcpy(&id, payload, SCHEMA_ID_SIZE);
+        index_insert(table, index, value, length, id);
+        num_rows++;
+
+        if (pager->txn_num_pages >= INDEX_BUILD_TXN_PAGES) {
+            pager_commit(pager);
+            pager_maybe_flush(pager);
+            pager_begin(pager);
+        }
+
+        cursor_advance(cursor);
+    }
+
+    cursor_close(cursor);
+
+    return num_rows;
+}
+
+uint32_t*
+root_node_catalog(void* node) {
+    return node + ROOT_NODE_CATALOG_OFFSET;
+}
+
+// builds an index on the column out of the rows already there and adds it to the catalog, inserts keep it up to date
+// from then on
+ExecuteResult
+table_index_create(Table* table, Column column, uint64_t* num_rows) {
+    Pager* pager = table->pager;
+
+    pthread_mutex_lock(&(table->writer_lock));
+
+    for (uint32_t i = 0; i < table->num_indexes; i++) {
+        if (table->indexes[i].column == column) {
+            pthread_mutex_unlock(&(table->writer_lock));
+            return EXEC_DUPLICATE_KEY;
+        }
+    }
+
+    Index* index = &(table->indexes[table->num_indexes]);
+
+    index->column = column;
+    index->root_page_num = get_unused_page_num(pager);
+    index->entries = malloc((INDEX_NODE_MAX_CELLS + 1) * sizeof(IndexEntry));
+
+    pager_begin(pager);
+
+    void* root = pager_latch(pager, index->root_page_num, LATCH_EXCLUSIVE);
+
+    pager_mark_dirty(pager, index->root_page_num);
+    init_index_node(root, NODE_INDEX_LEAF);
+    set_node_root(root, true);
+    pager_unlatch(pager, index->root_page_num);
+
+    *num_rows = index_fill(table, index);
+
+    // the catalog page is made along with the first index
+    void* table_root = pager_latch(pager, table->root_page_num, LATCH_EXCLUSIVE);
+    uint32_t catalog_page_num = *root_node_catalog(table_root);
+
+    if (catalog_page_num == 0) {
+        catalog_page_num = get_unused_page_num(pager);
+        pager_mark_dirty(pager, table->root_page_num);
+        *root_node_catalog(table_root) = catalog_page_num;
+    }
+
+    uint32_t* catalog = pager_latch(pager, catalog_page_num, LATCH_EXCLUSIVE);
+
+    pager_mark_dirty(pager, catalog_page_num);
+    catalog[0] = CATALOG_MAGIC;
+    catalog[1] = table->num_indexes + 1;
+    catalog[2 + 2 * table->num_indexes] = column;
+    catalog[3 + 2 * table->num_indexes] = index->root_page_num;
+    pager_unlatch(pager, catalog_page_num);
+    pager_unlatch(pager, table->root_page_num);
+
+    pager_commit(pager);
+    index->seq = pager->commit_seq;
+    __atomic_store_n(&(table->num_indexes), table->num_indexes + 1, __ATOMIC_RELEASE);
+    pager_maybe_flush(pager);
+
+    pthread_mutex_unlock(&(table->writer_lock));
+
+    return EXEC_RES_SUCCESS;
+}
+
+// reads the indexes listed by the catalog, when there's one
+void
+table_catalog_load(Table* table) {
+    Pager* pager = table->pager;
+    void* root = pager_latch(pager, table->root_page_num, LATCH_SHARED);
+    uint32_t catalog_page_num = *root_node_catalog(root);
+
+    pager_unlatch(pager, table->root_page_num);
+
+    if (catalog_page_num == 0) {
+        return;
+    }
+
+    uint32_t* catalog = pager_latch(pager, catalog_page_num, LATCH_SHARED);
+
+    if (catalog[0] != CATALOG_MAGIC || catalog[1] > INDEX_MAX) {
+        printf("corrupted catalog at page %d\n", catalog_page_num);
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < catalog[1]; i++) {
+        Index* index = &(table->indexes[i]);
+
+        index->column = catalog[2 + 2 * i];
+        index->root_page_num = catalog[3 + 2 * i];
+        index->seq = 0;
+        index->entries = malloc((INDEX_NODE_MAX_CELLS + 1) * sizeof(IndexEntry));
+    }
+
+    table->num_indexes = catalog[1];
+    pager_unlatch(pager, catalog_page_num);
+}
+
+void
+export_buffer_init(ExportBuffer* buffer, int fd, uint64_t offset) {
+    buffer->fd = fd;
+    buffer->offset = offset;
+    buffer->length = 0;
+    buffer->data = malloc(EXPORT_BUFFER_SIZE);
+}
+
+bool
+export_buffer_flush(ExportBuffer* buffer) {
+    uint32_t written = 0;
+
+    while (written < buffer->length) {
+        ssize_t bytes_written = pwrite(buffer->fd, buffer->data + written, buffer->length - written,
+                                       buffer->offset + written);
+
+        if (bytes_written == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (bytes_written <= 0) {
+            return false;
+        }
+
+        written += bytes_written;
+    }
+
+    buffer->offset += buffer->length;
+    buffer->length = 0;
+
+    return true;
+}
+
+// room for `size` more bytes at the end of the buffer, what the buffer held is written out first when they don't fit
+char*
+export_buffer_reserve(ExportBuffer* buffer, uint32_t size, bool* ok) {
+    if (buffer->length + size > EXPORT_BUFFER_SIZE && !export_buffer_flush(buffer)) {
+        // the export is given up, the bytes are dropped so the caller still writes inside the buffer
+        buffer->length = 0;
+        *ok = false;
+    }
+
+    return buffer->data + buffer->length;
+}
+
+// NOTE: digits are produced two at a time from a table, the value is written right to left then moved in place
+uint32_t
+format_u32(char* destination, uint32_t value) {
+    static const char digit_pairs[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+                                      "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+                                      "8081828384858687888990919293949596979899";
+    char digits[10];
+    char* end = digits + sizeof(digits);
+    char* start = end;
+
+    while (value >= 100) {
+        start -= 2;
+        memcpy(start, digit_pairs + (value % 100) * 2, 2);
+        value /= 100;
+    }
+
+    if (value >= 10) {
+        start -= 2;
+        memcpy(start, digit_pairs + value * 2, 2);
+    } else {
+        *(--start) = '0' + value;
+    }
+
+    memcpy(destination, start, end - start);
+
+    return end - start;
+}
+
+// writes a CSV field, quoted when it holds a separator or a quote, and returns its length
+uint32_t
+format_csv_field(char* destination, const char* value, uint32_t length) {
+    if (memchr(value, ',', length) == NULL && memchr(value, '"', length) == NULL) {
+        memcpy(destination, value, length);
+        return length;
+    }
+
+    uint32_t written = 0;
+
+    destination[written++] = '"';
+
+    for (uint32_t i = 0; i < length; i++) {
+        if (value[i] == '"') {
+            destination[written++] = '"';
+        }
+
+        destination[written++] = value[i];
+    }
+
+    destination[written++] = '"';
+
+    return written;
+}
+
+uint64_t
+export_align(uint64_t offset) {
+    return (offset + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+}
+
+// writes every row of a snapshot of the table to `filename`. Rows are formatted straight out of the leaf payloads into
+// large buffers, a binary export counts the rows first so every column knows where it starts
+ExecuteResult
+table_export(Table* table, const char* filename, ExportFormat format, uint64_t* num_rows) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+
+    if (fd == -1) {
+        printf("unable to open %s\n", filename);
+        return EXEC_BAD_INPUT;
+    }
+
+    Snapshot* snapshot = snapshot_begin(table);
+    Cursor* cursor = snapshot_seek(snapshot, 0);
+    ExportHeader header = {0};
+    // the ids, names and emails of a binary export, a CSV export only uses the first buffer
+    ExportBuffer columns[3];
+    uint32_t num_columns = 1;
+    bool ok = true;
+
+    if (format == EXPORT_BINARY) {
+        uint64_t count = 0;
+
+        do {
+            count += *leaf_node_num_cells(cursor->node) - cursor->cell_num;
+        } while (cursor_next_leaf(cursor));
+
+        cursor_close(cursor);
+        cursor = snapshot_seek(snapshot, 0);
+
+        header.magic = EXPORT_MAGIC;
+        header.version = EXPORT_VERSION;
+        header.num_rows = count;
+        header.name_width = NAME_SIZE;
+        header.email_width = EMAIL_SIZE;
+        header.id_offset = export_align(sizeof(ExportHeader));
+        header.name_offset = export_align(header.id_offset + count * SCHEMA_ID_SIZE);
+        header.email_offset = export_align(header.name_offset + count * NAME_SIZE);
+
+        export_buffer_init(&(columns[0]), fd, header.id_offset);
+        export_buffer_init(&(columns[1]), fd, header.name_offset);
+        export_buffer_init(&(columns[2]), fd, header.email_offset);
+        num_columns = 3;
+    } else {
+        export_buffer_init(&(columns[0]), fd, 0);
+    }
+
+    // id, separators, newline and both strings quoted with every character escaped
+    const uint32_t csv_row_max_size = 10 + 3 + 2 * (NAME_SIZE + 1) + 2 * (EMAIL_SIZE + 1);
+
+    *num_rows = 0;
+
+    do {
+        void* node = cursor->node;
+        uint32_t num_cells = *leaf_node_num_cells(node);
+
+        for (uint32_t cell_num = cursor->cell_num; cell_num < num_cells && ok; cell_num++) {
+            uint8_t* payload = leaf_node_value(node, cell_num);
+            uint32_t id;
+            uint8_t name_length = payload[SCHEMA_ID_SIZE];
+            const char* name = (const char*) payload + SCHEMA_ID_SIZE + SCHEMA_LENGTH_PREFIX_SIZE;
+            uint8_t email_length = name[name_length];
+            const char* email = name + name_length + SCHEMA_LENGTH_PREFIX_SIZE;
+
+            memcpy(&id, payload, SCHEMA_ID_SIZE);
+
+            if (format == EXPORT_BINARY) {
+                char* value = export_buffer_reserve(&(columns[0]), SCHEMA_ID_SIZE, &ok);
+
+                memcpy(value, &id, SCHEMA_ID_SIZE);
+                columns[0].length += SCHEMA_ID_SIZE;
+
+                value = export_buffer_reserve(&(columns[1]), NAME_SIZE, &ok);
+                memcpy(value, name, name_length);
+                memset(value + name_length, 0, NAME_SIZE - name_length);
+                columns[1].length += NAME_SIZE;
+
+                value = export_buffer_reserve(&(columns[2]), EMAIL_SIZE, &ok);
+                memcpy(value, email, email_length);
+                memset(value + email_length, 0, EMAIL_SIZE - email_length);
+                columns[2].length += EMAIL_SIZE;
+            } else {
+                char* line = export_buffer_reserve(&(columns[0]), csv_row_max_size, &ok);
+                uint32_t length = format_u32(line, id);
+
+                line[length++] = ',';
+                length += format_csv_field(line + length, name, name_length);
+                line[length++] = ',';
+                length += format_csv_field(line + length, email, email_length);
+                line[length++] = '\n';
+                columns[0].length += length;
+            }
+
+            *num_rows += 1;
+        }
+    } while (ok && cursor_next_leaf(cursor));
+
+    cursor_close(cursor);
+    snapshot_end(snapshot);
+
+    for (uint32_t i = 0; i < num_columns; i++) {
+        ok = ok && export_buffer_flush(&(columns[i]));
+        free(columns[i].data);
+    }
+
+    // NOTE: the header goes last, an export that didn't make it to the end isn't taken for a complete one
+    if (ok && format == EXPORT_BINARY) {
+        ok = pwrite(fd, &header, sizeof(ExportHeader), 0) == sizeof(ExportHeader);
+    }
+
+    close(fd);
+
+    if (!ok) {
+        printf("ERR: unable to write %s\n", filename);
+        return EXEC_BAD_INPUT;
+    }
+
+    return EXEC_RES_SUCCESS;
 }
 
-Cursor*
-table_find(Table* table, uint32_t key) {
-    void* root_node = get_page(table->pager, table->root_page_num);
+// listens on a TCP port when the address is a number, on a unix socket at that path otherwise
+int
+server_listen(const char* address) {
+    int fd;
+
+    if (address[0] != 0 && address[strspn(address, "0123456789")] == 0) {
+        struct sockaddr_in addr = {0};
+        int enable = 1;
+
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(atoi(address));
+
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+        if (fd == -1 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) == -1
+            || bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+            printf("unable to bind port %s: %d\n", address, errno);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        struct sockaddr_un addr = {0};
+
+        if (strlen(address) >= sizeof(addr.sun_path)) {
+            printf("unix socket path is too long\n");
+            exit(EXIT_FAILURE);
+        }
+
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, address);
+        unlink(address);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 
-    if (get_node_type(root_node) == NODE_LEAF) {
-        return leaf_node_find(table, table->root_page_num, key);
-    } else {
-        return internal_node_find(table, table->root_page_num, key);
-    } 
+        if (fd == -1 || bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+            printf("unable to bind unix socket %s: %d\n", address, errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (listen(fd, SERVER_LISTEN_BACKLOG) == -1) {
+        printf("unable to listen on %s: %d\n", address, errno);
+        exit(EXIT_FAILURE);
+    }
+
+    return fd;
 }
 
-Cursor*
-leaf_node_find(Table* table, uint32_t page_num, uint32_t key) {
-    void* node = get_page(table->pager, page_num);
-    uint32_t num_cells = *leaf_node_num_cells(node);
-    Cursor* cursor = malloc(sizeof(Cursor));
+void
+server_accept(Server* server) {
+    while (true) {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
 
-    cursor->table = table;
-    cursor->page_num = page_num;
+        if (fd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED && errno != EINTR) {
+                printf("error accepting connection: %d\n", errno);
+            }
 
-    // binary search tree implementation
-    uint32_t start_idx = 0;
-    uint32_t end_idx = num_cells;
+            return;
+        }
 
-    while (start_idx != end_idx) {
-        uint32_t middle = (start_idx + end_idx) / 2;
-        uint32_t key_at_index = *leaf_node_key(node, middle);
+        // answers are small and pipelined, don't hold them back waiting for acks
+        int enable = 1;
 
-        if (key == key_at_index) {
-            cursor->cell_num = middle;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
 
-            return cursor;
-        } else if (key < key_at_index) {
-            end_idx = middle;
-        } else {
-            start_idx = middle + 1;
+        Connection* connection = malloc(sizeof(Connection));
+
+        connection->fd = fd;
+        connection->buffer = NULL;
+        connection->length = 0;
+        connection->capacity = 0;
+        connection->binary = false;
+        connection->prepared = NULL;
+        connection->num_prepared = 0;
+        connection->next_ready = NULL;
+        connection->prev = NULL;
+
+        pthread_mutex_lock(&(server->lock));
+        connection->next = server->connections;
+
+        if (server->connections != NULL) {
+            server->connections->prev = connection;
+        }
+
+        server->connections = connection;
+        pthread_mutex_unlock(&(server->lock));
+
+        struct epoll_event event = {.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT, .data.ptr = connection};
+
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+            printf("error watching connection: %d\n", errno);
+            exit(EXIT_FAILURE);
         }
     }
+}
+
+// NOTE: the caller holds the server lock
+void
+server_unlink_connection(Server* server, Connection* connection) {
+    if (connection->prev != NULL) {
+        connection->prev->next = connection->next;
+    } else {
+        server->connections = connection->next;
+    }
 
-    cursor->cell_num = start_idx;
+    if (connection->next != NULL) {
+        connection->next->prev = connection->prev;
+    }
 
-    return cursor;
+    close(connection->fd);
+    free(connection->buffer);
+    free(connection->prepared);
+    free(connection);
 }
 
-NodeType
-get_node_type(void* node) {
-    uint8_t type = *((uint8_t*) (node + NODE_TYPE_OFFSET));
+// reads what the client sent so far, up to SERVER_TURN_READ bytes and as long as the buffer has room. Returns false
+// once the client hung up or the connection broke
+bool
+server_receive(Connection* connection) {
+    size_t received = 0;
 
-    return (NodeType) type;
+    while (received < SERVER_TURN_READ) {
+        if (connection->capacity - connection->length < SERVER_READ_SIZE && connection->capacity < SERVER_MAX_BUFFER) {
+            connection->capacity = connection->capacity == 0 ? 2 * SERVER_READ_SIZE : connection->capacity * 2;
+
+            if (connection->capacity > SERVER_MAX_BUFFER) {
+                connection->capacity = SERVER_MAX_BUFFER;
+            }
+
+            connection->buffer = realloc(connection->buffer, connection->capacity);
+        }
+
+        if (connection->length == connection->capacity) {
+            return true;
+        }
+
+        ssize_t bytes_read =
+            recv(connection->fd, connection->buffer + connection->length, connection->capacity - connection->length, 0);
+
+        if (bytes_read > 0) {
+            connection->length += bytes_read;
+            received += bytes_read;
+        } else if (bytes_read == 0) {
+            return false;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true;
+        } else if (errno != EINTR) {
+            return false;
+        }
+    }
+
+    // NOTE: the rest is left in the socket, the connection is watched again once this turn is over
+    return true;
 }
 
-void
-set_node_type(void* node, NodeType type) {
-    *((uint8_t*) (node + NODE_TYPE_OFFSET)) = (uint8_t) type;
+// returns false when the connection broke or the client didn't take its answers within SERVER_SEND_TIMEOUT_MS
+bool
+server_send(int fd, const char* data, size_t length) {
+    size_t sent = 0;
+
+    while (sent < length) {
+        ssize_t bytes_sent = send(fd, data + sent, length - sent, MSG_NOSIGNAL);
+
+        if (bytes_sent >= 0) {
+            sent += bytes_sent;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // the client isn't reading its answers, wait for room in the socket buffer
+            struct pollfd poll_fd = {.fd = fd, .events = POLLOUT};
+
+            if (poll(&poll_fd, 1, SERVER_SEND_TIMEOUT_MS) == 0) {
+                return false;
+            }
+        } else if (errno != EINTR) {
+            return false;
+        }
+    }
+
+    return true;
 }
 
+// one turn of a connection: runs every complete line received, in order, and sends all the answers at once
 void
-leaf_node_split_and_insert(Cursor* cursor, __attribute__((unused)) uint32_t key, Row* data) {
-    void* old_node = get_page(cursor->table->pager, cursor->page_num);
-    uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
-    void* new_node = get_page(cursor->table->pager, new_page_num);
+server_serve(Server* server, Connection* connection) {
+    bool open = server_receive(connection);
+    char* response = NULL;
+    size_t response_length = 0;
+    FILE* output = open_memstream(&response, &response_length);
+    size_t consumed = 0;
 
-    init_leaf_node(new_node);
+    while (open) {
+        char* line = connection->buffer + consumed;
 
-    for (uint32_t i = LEAF_NODE_MAX_CELLS; i >= 0; i--) {
-        void* destination_node;
+        if (connection->binary) {
+            uint32_t frame_length;
 
-        if (i >= LEAF_NODE_LEFT_SPLIT_COUNT) {
-            destination_node = new_node;
-        } else {
-            destination_node = old_node;
+            if (connection->length - consumed < sizeof(uint32_t)) {
+                break;
+            }
+
+            memcpy(&frame_length, line, sizeof(uint32_t));
+
+            if (frame_length == 0 || frame_length > SERVER_MAX_FRAME) {
+                open = false;
+                break;
+            }
+
+            if (connection->length - consumed < sizeof(uint32_t) + frame_length) {
+                break;
+            }
+
+            consumed += sizeof(uint32_t) + frame_length;
+            server_run_frame(server, connection, (uint8_t*) line + sizeof(uint32_t), frame_length, output, &response);
+            continue;
         }
 
-        uint32_t idx_within_node = i % LEAF_NODE_LEFT_SPLIT_COUNT;
-        void* destination = leaf_node_cell(destination_node, idx_within_node);
+        char* end = memchr(line, '\n', connection->length - consumed);
 
-        if (i == cursor->cell_num) {
-            row_serialize(data, destination);
-        } else if (i > cursor->cell_num) {
-            memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
+        if (end == NULL) {
+            break;
+        }
+
+        consumed = end - connection->buffer + 1;
+        *end = 0;
+
+        if (end > line && end[-1] == '\r') {
+            end[-1] = 0;
+        }
+
+        if (strcmp(line, ".exit") == 0) {
+            open = false;
+            break;
+        } else if (strcmp(line, ".binary") == 0) {
+            connection->binary = true;
+            fprintf(output, "binary\n");
+        } else if (line[0] == '.') {
+            fprintf(output, "unrecognized command: '%s'\n", line);
         } else {
-            memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
+            run_statement(line, server->table, output);
         }
     }
 
-    *(leaf_node_num_cells(old_node)) = LEAF_NODE_LEFT_SPLIT_COUNT;
-    *(leaf_node_num_cells(new_node)) = LEAF_NODE_RIGHT_SPLIT_COUNT;
+    fclose(output);
 
-    if (is_node_root(old_node)) {
-        return create_new_root(cursor->table, new_page_num);
-    } else {
-        printf("need to implement updating parent after split\n");
-        exit(EXIT_FAILURE);
+    if (!server_send(connection->fd, response, response_length)) {
+        open = false;
     }
-}
 
-uint32_t
-get_unused_page_num(Pager* pager) {
-    return pager->num_pages;
-}
+    free(response);
 
-void
-create_new_root(Table* table, uint32_t right_child_page_num) {
-    void* root = get_page(table->pager, table->root_page_num);
-    __attribute__((unused)) void* right_child = get_page(table->pager, right_child_page_num);
-    uint32_t left_child_page_num = get_unused_page_num(table->pager);
-    void* left_child = get_page(table->pager, left_child_page_num);
+    memmove(connection->buffer, connection->buffer + consumed, connection->length - consumed);
+    connection->length -= consumed;
 
-    // move previous root to the left children
-    memcpy(left_child, root, PAGE_SIZE);
-    set_node_root(left_child, false);
+    if (connection->length == SERVER_MAX_BUFFER) {
+        // a full buffer without a single complete line or frame in it
+        open = false;
+    }
 
-    init_internal_node(root);
-    set_node_root(root, true);
-    *internal_node_num_keys(root) = 1;
-    *internal_node_child(root, 0) = left_child_page_num;
+    if (!open) {
+        pthread_mutex_lock(&(server->lock));
+        server_unlink_connection(server, connection);
+        pthread_mutex_unlock(&(server->lock));
 
-    uint32_t left_child_max_key = get_node_max_key(left_child);
+        return;
+    }
 
-    *internal_node_key(root, 0) = left_child_max_key;
-    *internal_node_right_child(root) = right_child_page_num;
-}
+    struct epoll_event event = {.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT, .data.ptr = connection};
 
-uint32_t*
-internal_node_num_keys(void* node) {
-    return node + INTERNAL_NODE_NUM_KEYS_OFFSET;
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event) == -1) {
+        printf("error watching connection: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
 }
 
-uint32_t*
-internal_node_right_child(void* node) {
-    return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
+// writes the header of an answer frame, the length is filled in by server_end_frame once the payload is written
+long
+server_begin_frame(FILE* output, BinaryStatus status) {
+    long start = ftell(output);
+    uint32_t length = 0;
+
+    fwrite(&length, sizeof(uint32_t), 1, output);
+    fputc(status, output);
+
+    return start;
 }
 
-uint32_t*
-internal_node_cell(void* node, uint32_t cell_num) {
-    return node + INTERNAL_NODE_HEADER_SIZE + cell_num * INTERNAL_NODE_CELL_SIZE;
+// NOTE: `response` is the buffer of the memstream `output` writes to, it's only up to date after a flush
+void
+server_end_frame(FILE* output, char** response, long start) {
+    fflush(output);
+
+    uint32_t length = ftell(output) - start - sizeof(uint32_t);
+
+    memcpy(*response + start, &length, sizeof(uint32_t));
 }
 
-uint32_t*
-internal_node_child(void* node, uint32_t child_num) {
-    uint32_t num_keys = *internal_node_num_keys(node);
+void
+server_answer(FILE* output, char** response, BinaryStatus status) {
+    server_end_frame(output, response, server_begin_frame(output, status));
+}
 
-    if (child_num > num_keys) {
-        printf("trying to access an invalid children\n");
-        exit(EXIT_FAILURE);
-    } else if (child_num == num_keys) {
-        return internal_node_right_child(node);
-    } else {
-        return internal_node_cell(node, child_num);
+BinaryStatus
+binary_prepare_status(PrepareResult result) {
+    switch (result) {
+        case (PREP_SUCCESS):
+            return BIN_OK;
+        case (PREP_UNRECOGNIZED_STATEMENT):
+            return BIN_UNRECOGNIZED_STATEMENT;
+        case (PREP_NEGATIVE_ROW_ID):
+            return BIN_NEGATIVE_ROW_ID;
+        case (PREP_STR_TOO_LONG):
+            return BIN_STR_TOO_LONG;
+        default:
+            return BIN_SYNTAX_ERROR;
     }
 }
 
-uint32_t*
-internal_node_key(void* node, uint32_t key_num) {
-    return internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
+BinaryStatus
+binary_execute_status(ExecuteResult result) {
+    switch (result) {
+        case (EXEC_RES_SUCCESS):
+            return BIN_OK;
+        case (EXEC_RES_TABLE_FULL):
+            return BIN_TABLE_FULL;
+        case (EXEC_DUPLICATE_KEY):
+            return BIN_DUPLICATE_KEY;
+        default:
+            return BIN_BAD_REQUEST;
+    }
 }
 
-uint32_t
-get_node_max_key(void* node) {
-    switch (get_node_type(node)) {
-        case NODE_INTERNAL:
-            return *internal_node_key(node, *internal_node_num_keys(node) - 1);
-        case NODE_LEAF:
-            return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+// the prepared statement a request names, NULL when the handle isn't open
+PreparedStatement*
+server_prepared(Connection* connection, const uint8_t* body, uint32_t body_length) {
+    uint32_t handle;
+
+    if (body_length < sizeof(uint32_t)) {
+        return NULL;
     }
-}
 
-bool
-is_node_root(void* node) {
-    uint8_t value = *((uint8_t*) (node + IS_ROOT_OFFSET));
+    memcpy(&handle, body, sizeof(uint32_t));
 
-    return (bool) value;
-}
+    if (handle >= connection->num_prepared || !connection->prepared[handle].in_use) {
+        return NULL;
+    }
 
-void
-set_node_root(void* node, bool is_root) {
-    *((uint8_t*) (node + IS_ROOT_OFFSET)) = (uint8_t) is_root;
+    return &(connection->prepared[handle]);
 }
 
 void
-init_internal_node(void* node) {
-    set_node_type(node, NODE_INTERNAL);
-    set_node_root(node, false);
-    *internal_node_num_keys(node) = 0;
+server_prepare(Connection* connection, const uint8_t* body, uint32_t body_length, FILE* output, char** response) {
+    if (body_length > PREPARED_MAX_TEXT) {
+        server_answer(output, response, BIN_BAD_REQUEST);
+        return;
+    }
+
+    char text[PREPARED_MAX_TEXT + 1];
+    uint32_t handle = 0;
+
+    memcpy(text, body, body_length);
+    text[body_length] = 0;
+
+    while (handle < connection->num_prepared && connection->prepared[handle].in_use) {
+        handle++;
+    }
+
+    if (handle == connection->num_prepared) {
+        connection->num_prepared = connection->num_prepared == 0 ? 8 : connection->num_prepared * 2;
+        connection->prepared = realloc(connection->prepared, connection->num_prepared * sizeof(PreparedStatement));
+
+        for (uint32_t i = handle; i < connection->num_prepared; i++) {
+            connection->prepared[i].in_use = false;
+        }
+    }
+
+    PreparedStatement* prepared = &(connection->prepared[handle]);
+    BinaryStatus status = binary_prepare_status(prepare_statement(text, &(prepared->statement), prepared));
+
+    if (status != BIN_OK) {
+        server_answer(output, response, status);
+        return;
+    }
+
+    long start = server_begin_frame(output, BIN_OK);
+
+    prepared->in_use = true;
+    fwrite(&handle, sizeof(uint32_t), 1, output);
+    server_end_frame(output, response, start);
 }
 
+// runs a prepared statement. An insert copies the row it was given straight into the leaf, nothing is parsed
 void
-indent(uint32_t level) {
-    for (uint32_t i = 0; i < level; i++) {
-        printf("\t");
+server_execute(Server* server, PreparedStatement* prepared, const uint8_t* params, uint32_t params_length,
+               FILE* output, char** response) {
+    if (prepared->statement.type == STMT_INSERT) {
+        if (!row_payload_valid(params, params_length)) {
+            server_answer(output, response, BIN_BAD_REQUEST);
+            return;
+        }
+
+        uint64_t started_ns = stats_now_ns();
+        ExecuteResult result = table_insert(server->table, params, params_length);
+
+        latency_record(&(server->table->insert_latency), started_ns);
+        server_answer(output, response, binary_execute_status(result));
+        return;
+    }
+
+    if (params_length != prepared->num_params * sizeof(uint32_t)) {
+        server_answer(output, response, BIN_BAD_REQUEST);
+        return;
+    }
+
+    Statement statement = prepared->statement;
+
+    for (uint32_t i = 0; i < prepared->num_params; i++) {
+        uint32_t value;
+
+        memcpy(&value, params + i * sizeof(uint32_t), sizeof(uint32_t));
+        select_range_set(&(statement.range), prepared->params[i], value);
     }
+
+    statement.format = ROW_FORMAT_BINARY;
+
+    long start = server_begin_frame(output, BIN_OK);
+    uint64_t started_ns = stats_now_ns();
+
+    exec_stmt_select(&statement, server->table, output);
+    latency_record(&(server->table->select_latency), started_ns);
+    server_end_frame(output, response, start);
 }
 
+// runs one request of a binary connection, `frame` is what follows the length
 void
-display_tree(Pager* pager, uint32_t page_num, uint32_t indent_level) {
-    void* node = get_page(pager, page_num);
-    uint32_t num_keys, child;
+server_run_frame(Server* server, Connection* connection, const uint8_t* frame, uint32_t length, FILE* output,
+                 char** response) {
+    const uint8_t* body = frame + 1;
+    uint32_t body_length = length - 1;
+    PreparedStatement* prepared;
+
+    switch (frame[0]) {
+        case (BIN_PREPARE):
+            server_prepare(connection, body, body_length, output, response);
+            break;
+        case (BIN_EXECUTE):
+            prepared = server_prepared(connection, body, body_length);
 
-    switch (get_node_type(node)) {
-        case NODE_LEAF:
-            num_keys = *leaf_node_num_cells(node);
+            if (prepared == NULL) {
+                server_answer(output, response, BIN_BAD_REQUEST);
+                break;
+            }
 
-            indent(indent_level);
-            printf("leaf.length = %d\n", num_keys);
+            server_execute(server,
+                           prepared,
+                           body + sizeof(uint32_t),
+                           body_length - sizeof(uint32_t),
+                           output,
+                           response);
+            break;
+        case (BIN_CLOSE):
+            prepared = server_prepared(connection, body, body_length);
 
-            for (uint32_t i = 0; i < num_keys; i++) {
-                indent(indent_level + 1);
-                printf("%d\n", *leaf_node_key(node, i));
+            if (prepared != NULL) {
+                prepared->in_use = false;
             }
 
+            server_answer(output, response, prepared != NULL ? BIN_OK : BIN_BAD_REQUEST);
             break;
-        case NODE_INTERNAL:
-            num_keys = *internal_node_num_keys(node);
+        default:
+            server_answer(output, response, BIN_BAD_REQUEST);
+            break;
+    }
+}
 
-            indent(indent_level);
-            printf("internal.length = %d\n", num_keys);
+void*
+server_worker_main(void* arg) {
+    Server* server = arg;
 
-            for (uint32_t i = 0; i < num_keys; i++) {
-                child = *internal_node_child(node, i);
+    pthread_mutex_lock(&(server->lock));
 
-                display_tree(pager, child, indent_level + 1);
-                indent(indent_level + 1);
-                printf("key: %d\n", *internal_node_key(node, i));
-            }
+    while (true) {
+        while (server->running && server->ready_head == NULL) {
+            pthread_cond_wait(&(server->ready), &(server->lock));
+        }
 
-            child = *internal_node_right_child(node);
+        if (!server->running) {
+            break;
+        }
 
-            display_tree(pager, child, indent_level + 1);
+        Connection* connection = server->ready_head;
 
-            break;
+        server->ready_head = connection->next_ready;
+
+        if (server->ready_head == NULL) {
+            server->ready_tail = NULL;
+        }
+
+        pthread_mutex_unlock(&(server->lock));
+        server_serve(server, connection);
+        pthread_mutex_lock(&(server->lock));
     }
+
+    pthread_mutex_unlock(&(server->lock));
+
+    return NULL;
 }
 
-Cursor* internal_node_find(Table* table, uint32_t page_num, uint32_t key) {
-    void* node = get_page(table->pager, page_num);
-    uint32_t num_keys = *internal_node_num_keys(node);
+// serves the database to clients until SIGINT or SIGTERM. The event loop only accepts connections and hands the
+// ones with input to the workers, which read, run and answer the requests
+void
+server_run(const char* filename, DbOptions* options, const char* address, uint32_t num_workers) {
+    sigset_t signals;
+
+    // NOTE: blocked before any thread starts, the log writer included, so only the signalfd ever sees them
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    Server* server = malloc(sizeof(Server));
+
+    server->table = db_open(filename, options);
+    server->listen_fd = server_listen(address);
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    server->signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    server->running = true;
+    server->ready_head = NULL;
+    server->ready_tail = NULL;
+    server->connections = NULL;
+    server->num_workers = num_workers;
+    server->workers = malloc(num_workers * sizeof(pthread_t));
+
+    if (server->epoll_fd == -1 || server->signal_fd == -1) {
+        printf("unable to set up the event loop: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
 
-    uint32_t start_idx = 0;
-    uint32_t end_idx = num_keys;
+    pthread_mutex_init(&(server->lock), NULL);
+    pthread_cond_init(&(server->ready), NULL);
 
-    while (start_idx != end_idx) {
-        uint32_t middle = (start_idx + end_idx) / 2;
-        uint32_t key_to_right = *internal_node_key(node, middle);
+    // the listening socket is told apart by a NULL pointer and the signalfd by the server itself, anything else is a
+    // connection
+    struct epoll_event listen_event = {.events = EPOLLIN, .data.ptr = NULL};
+    struct epoll_event signal_event = {.events = EPOLLIN, .data.ptr = server};
 
-        if (key_to_right >= key) {
-            end_idx = start_idx;
-        } else {
-            start_idx = middle + 1;
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &listen_event) == -1
+        || epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->signal_fd, &signal_event) == -1) {
+        printf("unable to set up the event loop: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < num_workers; i++) {
+        if (pthread_create(&(server->workers[i]), NULL, server_worker_main, server) != 0) {
+            printf("unable to start worker %d\n", i);
+            exit(EXIT_FAILURE);
         }
     }
 
-    uint32_t child_num = *internal_node_child(node, start_idx);
-    void* child = get_page(table->pager, child_num);
+    printf("listening on %s with %d workers\n", address, num_workers);
+    fflush(stdout);
 
-    switch(get_node_type(child)) {
-        case NODE_INTERNAL:
-            return internal_node_find(table, child_num, key);
-        case NODE_LEAF:
-            return leaf_node_find(table, child_num, key);
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    bool running = true;
+
+    while (running) {
+        int num_events = epoll_wait(server->epoll_fd, events, SERVER_MAX_EVENTS, -1);
+
+        if (num_events == -1 && errno != EINTR) {
+            printf("error waiting for events: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < num_events; i++) {
+            if (events[i].data.ptr == NULL) {
+                server_accept(server);
+                continue;
+            }
+
+            if (events[i].data.ptr == server) {
+                running = false;
+                continue;
+            }
+
+            Connection* connection = events[i].data.ptr;
+
+            pthread_mutex_lock(&(server->lock));
+            connection->next_ready = NULL;
+
+            if (server->ready_tail != NULL) {
+                server->ready_tail->next_ready = connection;
+            } else {
+                server->ready_head = connection;
+            }
+
+            server->ready_tail = connection;
+            pthread_cond_signal(&(server->ready));
+            pthread_mutex_unlock(&(server->lock));
+        }
     }
+
+    // workers finish the turn they're in, connections still waiting for one are just closed
+    pthread_mutex_lock(&(server->lock));
+    server->running = false;
+    pthread_cond_broadcast(&(server->ready));
+    pthread_mutex_unlock(&(server->lock));
+
+    for (uint32_t i = 0; i < num_workers; i++) {
+        pthread_join(server->workers[i], NULL);
+    }
+
+    while (server->connections != NULL) {
+        server_unlink_connection(server, server->connections);
+    }
+
+    if (address[strspn(address, "0123456789")] != 0) {
+        unlink(address);
+    }
+
+    close(server->listen_fd);
+    close(server->signal_fd);
+    close(server->epoll_fd);
+    pthread_mutex_destroy(&(server->lock));
+    pthread_cond_destroy(&(server->ready));
+    db_close(server->table);
+    free(server->workers);
+    free(server);
 }
@@ -5,6 +5,27 @@
 #include <stdio.h>
 #include <sys/types.h>
 
+#define SERVER_LISTEN_BACKLOG 1024
+#define SERVER_MAX_EVENTS 256
+// free room made in the receive buffer of a connection before every read
+#define SERVER_READ_SIZE (16 * 1024)
+// frames longer than this are taken for garbage and the connection is closed
+#define SERVER_MAX_FRAME (1024 * 1024)
+// largest receive buffer of a connection, room for the longest frame and its length. A connection filling it without a
+// complete line or frame is closed
+#define SERVER_MAX_BUFFER (SERVER_MAX_FRAME + 4)
+// bytes read from a connection per turn, a client that keeps sending lets the worker go back to the others in between
+#define SERVER_TURN_READ (256 * 1024)
+// how long an answer waits for a client that stopped reading before the connection is dropped
+#define SERVER_SEND_TIMEOUT_MS 5000
+// longest statement text a prepare takes, the longest statement there is fits with room to spare
+#define PREPARED_MAX_TEXT 1024
+#define PREPARED_MAX_PARAMS 4
+// partitions a parallel scan aims at per thread, so a thread done early picks up some of the work of the others
+#define SCAN_PARTITIONS_PER_THREAD 4
+#define BATCH_READ_SIZE (1024 * 1024)
+#define BATCH_OUTPUT_SIZE (1024 * 1024)
+
 typedef struct {
     char *buffer;
     size_t buffer_length;
@@ -21,11 +42,132 @@ typedef enum {
     STMT_SELECT,
 } StatementType;
 
+// keys selected by `select [count | rank] [where id = N | where id between A and B] [limit N] [offset N]`, bounds are
+// inclusive and the offset skips rows of the range. `where name = S` and `where email = S` select every key, the rows
+// are filtered on Statement.column
+typedef struct {
+    uint32_t min_id;
+    uint32_t max_id;
+    uint32_t limit;
+    uint32_t offset;
+} SelectRange;
+
+typedef enum {
+    ROW_FORMAT_TEXT,  // `-- <id> <name> <email>` lines
+    ROW_FORMAT_BINARY,  // rows encoded the way they're stored, back to back
+} RowFormat;
+
+typedef enum {
+    SELECT_ROWS,
+    SELECT_COUNT,  // `select count ...` answers with how many rows it selected
+    SELECT_RANK,  // `select rank where id = N` answers with how many rows have a lower id
+} SelectKind;
+
 typedef struct {
     StatementType type;
     Row row;
+    SelectRange range;
+    RowFormat format;  // how a select writes its rows
+    SelectKind kind;
+    Column column;  // select: the column of the where clause, COLUMN_ID when the range is all there is
+    char value[EMAIL_SIZE + 1];  // select: the value the column is compared to
 } Statement;
 
+// nodes of one level of the tree, `fill` adds up the share of every node in use
+typedef struct {
+    uint64_t num_nodes;
+    uint64_t num_keys;
+    double fill;
+} LevelStats;
+
+// a range of keys spanning whole subtrees, scanned by one thread of a parallel scan
+typedef struct {
+    uint32_t min_id;
+    uint32_t max_id;
+    bool done;
+    char *output;  // what the scan wrote, until it's written out in order
+    size_t output_length;
+} ScanPartition;
+
+typedef struct {
+    Snapshot *snapshot;
+    Statement *statement;
+    ScanPartition *partitions;
+    uint32_t num_partitions;
+    uint32_t next_partition;  // next one a thread picks up
+    pthread_mutex_t lock;
+    pthread_cond_t partition_done;
+} ParallelScan;
+
+// the bounds of a SelectRange a `?` of a prepared select stands for, `where id = ?` sets both ends with one value
+typedef enum {
+    SELECT_BOUND_MIN_ID = 1,
+    SELECT_BOUND_MAX_ID = 2,
+    SELECT_BOUND_LIMIT = 4,
+    SELECT_BOUND_OFFSET = 8,
+} SelectBound;
+
+// a statement parsed once and run many times with the values of its `?` placeholders. A prepared insert is
+// `insert ? ? ?` and takes a whole row per execution, encoded the way it's stored
+typedef struct {
+    bool in_use;
+    Statement statement;
+    uint8_t num_params;
+    uint8_t params[PREPARED_MAX_PARAMS];  // select: the SelectBound flags each parameter sets, in order
+} PreparedStatement;
+
+// binary protocol, a text connection switches to it with `.binary`. Requests and answers are frames: a uint32_t
+// length of what follows, then a one byte opcode (requests) or BinaryStatus (answers) and the payload. Integers are
+// in the host's byte order, the way rows are stored
+typedef enum {
+    BIN_PREPARE = 1,  // statement text, answered with the uint32_t handle of the prepared statement
+    BIN_EXECUTE = 2,  // uint32_t handle then the row of an insert or a uint32_t per `?` of a select, the rows a select
+                      // returns are encoded the way they're stored, back to back
+    BIN_CLOSE = 3,  // uint32_t handle
+} BinaryOpcode;
+
+typedef enum {
+    BIN_OK,
+    BIN_BAD_REQUEST,
+    BIN_UNRECOGNIZED_STATEMENT,
+    BIN_SYNTAX_ERROR,
+    BIN_NEGATIVE_ROW_ID,
+    BIN_STR_TOO_LONG,
+    BIN_DUPLICATE_KEY,
+    BIN_TABLE_FULL,
+} BinaryStatus;
+
+// a client of the server, requests are lines, or frames once it switched to the binary protocol, and every one of them
+// is answered in order. The socket is armed with EPOLLONESHOT, so a single worker serves the connection at a
+// time and runs every request it received in one go: a client pipelining requests gets their answers in a single write
+typedef struct Connection {
+    int fd;
+    char *buffer;  // received bytes not run yet, only a partial request is left between two turns
+    size_t length;
+    size_t capacity;
+    bool binary;  // requests are frames instead of lines
+    PreparedStatement *prepared;  // indexed by handle, closed ones are reused
+    uint32_t num_prepared;
+    struct Connection *next_ready;  // next connection waiting for a worker
+    struct Connection *prev;
+    struct Connection *next;
+} Connection;
+
+typedef struct {
+    Table *table;
+    int listen_fd;
+    int epoll_fd;
+    int signal_fd;  // SIGINT and SIGTERM stop the server
+    bool running;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;  // signals the workers that a connection has input waiting
+    Connection *ready_head;
+    Connection *ready_tail;
+    Connection *connections;  // every open connection, they're closed on shutdown
+    uint32_t num_workers;
+    pthread_t *workers;
+} Server;
+
 typedef enum {
     PREP_SUCCESS,
     PREP_UNRECOGNIZED_STATEMENT,
@@ -38,46 +180,204 @@ typedef enum {
     EXEC_RES_SUCCESS,
     EXEC_RES_TABLE_FULL,
     EXEC_DUPLICATE_KEY,
+    EXEC_UNSORTED_KEY,
+    EXEC_TABLE_NOT_EMPTY,
+    EXEC_BAD_INPUT,
 } ExecuteResult;
 
 InputBuffer *new_input_buffer();
 void display_prompt();
-void read_input(InputBuffer *buffer);
+bool read_input(InputBuffer *buffer);
+void batch_run(Table *table, const char *script);
+size_t batch_run_lines(Table *table, char *data, size_t length, bool end_of_input);
+void batch_run_line(Table *table, char *line);
 MetaCmdResult exec_meta_cmd(InputBuffer *buffer, Table *table);
-PrepareResult prepare_statement(InputBuffer *buffer, Statement *statement);
+void run_statement(char *input, Table *table, FILE *output);
+PrepareResult prepare_statement(char *input, Statement *statement, PreparedStatement *prepared);
+PrepareResult parse_row(char *row_id_str, char *username, char *email, Row *row);
+PrepareResult parse_select(Statement *statement, char **save, PreparedStatement *prepared);
+PrepareResult parse_select_column(Statement *statement, char *column, char *operator, char *value);
+PrepareResult parse_select_bound(char *token, SelectRange *range, uint8_t bounds, PreparedStatement *prepared);
+void select_range_set(SelectRange *range, uint8_t bounds, uint32_t value);
 ExecuteResult exec_stmt_insert(Statement *statement, Table *table);
-ExecuteResult exec_stmt_select(Table *table);
-ExecuteResult exec_statement(Statement *statement, Table *table);
+ExecuteResult table_insert(Table *table, const void *payload, uint32_t size);
+ExecuteResult exec_stmt_select(Statement *statement, Table *table, FILE *output);
+void select_by_column(Snapshot *snapshot, Statement *statement, FILE *output);
+void output_row(FILE *output, Statement *statement, void *payload);
+void scan_rows(Cursor *cursor, Statement *statement, uint32_t max_id, uint32_t limit, FILE *output);
+uint32_t scan_partition(
+    Snapshot *snapshot, uint32_t min_id, uint32_t max_id, uint32_t max_partitions, ScanPartition **partitions);
+void *scan_worker_main(void *arg);
+void parallel_scan(
+    Snapshot *snapshot, Statement *statement, ScanPartition *partitions, uint32_t num_partitions, FILE *output);
+ExecuteResult exec_statement(Statement *statement, Table *table, FILE *output);
+uint64_t stats_now_ns();
+uint32_t latency_bucket(uint64_t ns);
+uint64_t latency_bucket_value(uint32_t bucket);
+void latency_record(LatencyHistogram *histogram, uint64_t started_ns);
+uint64_t latency_percentile(LatencyHistogram *histogram, double percentile);
+uint32_t table_level_stats(Snapshot *snapshot, uint32_t page_num, uint32_t level, void **buffers, LevelStats *levels);
+void latency_print(FILE *output, const char *name, LatencyHistogram *histogram, bool json);
+void table_stats_print(Table *table, FILE *output, bool json);
 void close_input_buffer();
-void show_row(Row *row);
+void show_row(FILE *output, Row *row);
 void *get_page(Pager *page, uint32_t page_num);
+void unpin_page(Pager *pager, uint32_t page_num);
+void pager_latch_init(pthread_rwlock_t *latch);
+void pager_save_version(Pager *pager, uint32_t page_num, const void *image);
+PageVersion *pager_find_version(Pager *pager, uint32_t page_num, uint64_t seq);
+void pager_prune_versions(Pager *pager);
+Snapshot *snapshot_begin(Table *table);
+void snapshot_open(Snapshot *snapshot, Table *table);
+void snapshot_end(Snapshot *snapshot);
+void snapshot_close(Snapshot *snapshot);
+void *snapshot_read_page(Snapshot *snapshot, uint32_t page_num, void *buffer);
+Cursor *snapshot_seek(Snapshot *snapshot, uint32_t key);
+void snapshot_cursor_seek(Cursor *cursor, Snapshot *snapshot, uint32_t key, void *leaf_buffer);
+uint64_t snapshot_rank(Snapshot *snapshot, uint32_t key, bool inclusive);
+bool snapshot_key_at(Snapshot *snapshot, uint64_t position, uint32_t *key);
+bool snapshot_may_contain(Snapshot *snapshot, uint32_t key);
+Index *snapshot_index(Snapshot *snapshot, Column column);
+BloomFilter *bloom_filter(Table *table, uint32_t page_num, bool create);
+uint64_t bloom_hash(uint32_t key);
+void bloom_add(Table *table, uint32_t page_num, uint32_t key);
+void bloom_add_leaf(Table *table, uint32_t page_num, void *node);
+bool bloom_may_contain(BloomFilter *filter, uint32_t key);
+void table_bloom_build(Table *table);
+void *pager_latch(Pager *pager, uint32_t page_num, LatchMode mode);
+void pager_unlatch(Pager *pager, uint32_t page_num);
+void pager_mark_dirty(Pager *pager, uint32_t page_num);
+void pager_flush_dirty(Pager *pager);
+void pager_maybe_flush(Pager *pager);
+void pager_begin(Pager *pager);
+void pager_commit(Pager *pager);
+void pager_checkpoint(Pager *pager);
+void pager_recover(Pager *pager);
+uint32_t crc32_update(uint32_t crc, const void *data, size_t length);
+Wal *wal_open(const char *db_filename, uint32_t commit_window_ms, bool synchronous, uint64_t checkpoint_bytes);
+void wal_flush(Wal *wal);
+void wal_wait(Wal *wal, uint64_t lsn);
+void wal_reset(Wal *wal);
+void wal_close(Wal *wal);
 void pager_flush(Pager *pager, uint32_t page_num);
 Cursor *table_start(Table *table);
+Cursor *table_seek(Table *table, uint32_t key);
+void cursor_seek(Cursor *cursor, Table *table, uint32_t key);
 void cursor_advance(Cursor *cursor);
+bool cursor_next_leaf(Cursor *cursor);
+void cursor_settle(Cursor *cursor);
+void cursor_release_ancestors(Cursor *cursor);
+void cursor_unlatch(Cursor *cursor);
+void cursor_close(Cursor *cursor);
 uint32_t *leaf_node_num_cells(void *node);
-void *leaf_node_cell(void *node, uint32_t cell_num);
+uint32_t *leaf_node_next_leaf(void *node);
+uint16_t *leaf_node_content_start(void *node);
 uint32_t *leaf_node_key(void *node, uint32_t cell_num);
+uint16_t *leaf_node_slot(void *node, uint32_t cell_num);
+uint16_t *leaf_node_fragmented_bytes(void *node);
+uint32_t leaf_node_free_space(void *node);
+bool leaf_node_has_room(void *node, uint32_t size);
+void *leaf_node_alloc_cell(void *node, uint32_t cell_num, uint32_t key, uint32_t size);
+void leaf_node_truncate(void *node, uint32_t num_cells);
+void leaf_node_compact(void *node);
+void *leaf_node_claim_cell(void *node, uint32_t cell_num, uint32_t key, uint32_t size);
+void leaf_node_put_row(void *node, uint32_t cell_num, uint32_t key, Row *data);
+void leaf_node_put_payload(void *node, uint32_t cell_num, uint32_t key, const void *payload, uint32_t size);
+uint32_t leaf_node_lower_bound(const uint32_t *keys, uint32_t num_keys, uint32_t key);
 void *leaf_node_value(void *node, uint32_t cell_num);
 void init_leaf_node(void *node);
-void leaf_node_insert(Cursor *cursor, uint32_t key, Row *data);
+void leaf_node_insert(Cursor *cursor, uint32_t key, const void *payload, uint32_t size);
 void display_constants();
-Cursor *table_find(Table *table, uint32_t key);
-Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key);
+Cursor *table_find(Table *table, uint32_t key, LatchMode mode);
+void cursor_find(Cursor *cursor, Table *table, uint32_t key, LatchMode mode);
+bool is_node_safe(void *node);
+void leaf_node_find(Cursor *cursor, uint32_t key);
 NodeType get_node_type(void *node);
 void set_node_type(void *node, NodeType type);
-void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, Row *data);
+void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, const void *payload, uint32_t size);
 uint32_t get_unused_page_num(Pager *pager);
-void create_new_root(Table *table, uint32_t right_child_page_num);
+void create_new_root(Table *table, uint32_t right_child_page_num, uint32_t separator);
+void internal_node_insert(
+    Table *table, Cursor *cursor, uint32_t level, uint32_t separator, uint32_t right_child_page_num);
+void internal_node_split_and_insert(
+    Table *table, Cursor *cursor, uint32_t level, uint32_t index, uint32_t separator, uint32_t right_child_page_num);
+uint32_t internal_node_find_child(void *node, uint32_t key);
+uint32_t count_keys_below_scalar(const uint32_t *keys, uint32_t num_keys, uint32_t key);
 uint32_t *internal_node_num_keys(void *node);
 uint32_t *internal_node_right_child(void *node);
-uint32_t *internal_node_cell(void *node, uint32_t cell_num);
+uint32_t *internal_node_keys(void *node);
+uint32_t *internal_node_children(void *node);
 uint32_t *internal_node_child(void *node, uint32_t child_num);
 uint32_t *internal_node_key(void *node, uint32_t key_num);
-uint32_t get_node_max_key(void *node);
+uint32_t *internal_node_count(void *node, uint32_t child_num);
+uint32_t node_row_count(void *node);
+void internal_node_count_child(Pager *pager, void *node, uint32_t child_num, uint32_t child_page_num);
+void internal_node_count_row(Table *table, const uint32_t *path, uint32_t depth, uint32_t key);
+uint32_t get_node_max_key(Pager *pager, void *node);
 bool is_node_root(void *node);
 void set_node_root(void *node, bool is_root);
 void init_internal_node(void *node);
 void display_tree(Pager *pager, uint32_t page_num, uint32_t indent_level);
-Cursor* internal_node_find(Table* table, uint32_t page_num, uint32_t key);
+void *node_latch(Pager *pager, uint32_t page_num, LatchMode inner_mode, LatchMode leaf_mode);
+void internal_node_find(Table *table, Cursor *cursor, uint32_t key, LatchMode inner_mode, LatchMode leaf_mode);
+BulkLoader *bulk_load_begin(Table *table, uint32_t fill_percent);
+ExecuteResult bulk_load_add(BulkLoader *loader, Row *row);
+void bulk_load_finish(BulkLoader *loader);
+ExecuteResult table_load_file(Table *table, const char *filename, uint32_t fill_percent, uint32_t *num_rows);
+uint16_t *index_node_num_cells(void *node);
+uint8_t *index_node_prefix_length(void *node);
+uint8_t *index_node_prefix(void *node);
+uint32_t *index_node_link(void *node);
+uint16_t *index_node_slot(void *node, uint32_t cell_num);
+uint8_t *index_node_cell(void *node, uint32_t cell_num);
+uint32_t index_cell_id(const uint8_t *cell);
+uint32_t index_cell_child(const uint8_t *cell);
+uint32_t index_node_child(void *node, uint32_t position);
+void init_index_node(void *node, NodeType type);
+int index_key_compare(
+    const uint8_t *a, uint32_t a_length, uint32_t a_id, const uint8_t *b, uint32_t b_length, uint32_t b_id);
+uint32_t index_node_lower_bound(void *node, const uint8_t *key, uint32_t length, uint32_t id);
+bool index_cell_matches(void *node, uint32_t cell_num, const uint8_t *key, uint32_t length);
+uint32_t index_common_prefix(IndexEntry *entries, uint32_t count);
+uint32_t index_node_size(IndexEntry *entries, uint32_t count, bool internal);
+uint32_t index_node_read(void *node, IndexEntry *entries);
+void index_node_write(void *node, IndexEntry *entries, uint32_t count);
+uint32_t index_split_point(IndexEntry *entries, uint32_t count, bool internal);
+void index_insert(Table *table, Index *index, const uint8_t *key, uint32_t length, uint32_t id);
+uint32_t index_lookup(Snapshot *snapshot, Index *index, const uint8_t *key, uint32_t length, uint32_t **ids);
+uint64_t index_fill(Table *table, Index *index);
+ExecuteResult table_index_create(Table *table, Column column, uint64_t *num_rows);
+void table_catalog_load(Table *table);
+uint32_t *root_node_catalog(void *node);
+void export_buffer_init(ExportBuffer *buffer, int fd, uint64_t offset);
+bool export_buffer_flush(ExportBuffer *buffer);
+char *export_buffer_reserve(ExportBuffer *buffer, uint32_t size, bool *ok);
+uint32_t format_u32(char *destination, uint32_t value);
+uint32_t format_csv_field(char *destination, const char *value, uint32_t length);
+uint64_t export_align(uint64_t offset);
+ExecuteResult table_export(Table *table, const char *filename, ExportFormat format, uint64_t *num_rows);
+int server_listen(const char *address);
+void server_accept(Server *server);
+void server_unlink_connection(Server *server, Connection *connection);
+bool server_receive(Connection *connection);
+bool server_send(int fd, const char *data, size_t length);
+void server_serve(Server *server, Connection *connection);
+long server_begin_frame(FILE *output, BinaryStatus status);
+void server_end_frame(FILE *output, char **response, long start);
+void server_answer(FILE *output, char **response, BinaryStatus status);
+BinaryStatus binary_prepare_status(PrepareResult result);
+BinaryStatus binary_execute_status(ExecuteResult result);
+PreparedStatement *server_prepared(Connection *connection, const uint8_t *body, uint32_t body_length);
+void server_prepare(Connection *connection, const uint8_t *body, uint32_t body_length, FILE *output, char **response);
+void server_execute(Server *server,
+                    PreparedStatement *prepared,
+                    const uint8_t *params,
+                    uint32_t params_length,
+                    FILE *output,
+                    char **response);
+void server_run_frame(
+    Server *server, Connection *connection, const uint8_t *frame, uint32_t length, FILE *output, char **response);
+void *server_worker_main(void *arg);
+void server_run(const char *filename, DbOptions *options, const char *address, uint32_t num_workers);
 
 #endif
@@ -0,0 +1,15 @@
+# sourced by every regression test: `sh tests/<name>.sh <durc binary>` runs durc on databases of a fresh directory
+# and compares what it printed with tests/<name>.expected
+set -e
+
+DURC="$1"
+TESTS=$(cd "$(dirname "$0")" && pwd)
+NAME=$(basename "$0" .sh)
+WORK=$(mktemp -d)
+
+trap 'rm -rf "$WORK"' EXIT
+
+# fails the test, showing the difference, unless `file` holds the expected output
+expect() {
+    diff -u "$TESTS/$NAME.expected" "$1"
+}
@@ -0,0 +1,32 @@
+# counts, ranks and offsets read from the row counts of the internal nodes agree with the rows of the table, before
+# and after inserts split the nodes holding them
+. "$(dirname "$0")/common.sh"
+
+# the multiples of 3 up to 15000, inserted out of order
+awk 'BEGIN { for (i = 1; i <= 5000; i++) printf "insert %d user%d user%d@example.com\n", (i * 7 % 5000 + 1) * 3, i, i }' \
+    > "$WORK/load"
+"$DURC" -f "$WORK/load" "$WORK/db" > /dev/null
+
+cat > "$WORK/script" <<'SCRIPT'
+select count
+select count(*)
+select count where id between 100 and 200
+select count where id = 300
+select count where id = 301
+select rank where id = 3000
+select rank where id = 3001
+select rank where id = 1
+select limit 3 offset 2500
+select where id between 6000 and 6030 limit 2 offset 3
+select offset 4998
+select offset 5000
+select count where id between 6000 and 6030 limit 2 offset 3
+insert 1 first first@example.com
+insert 3001 middle middle@example.com
+select count
+select rank where id = 3003
+select where id between 2997 and 3003
+SCRIPT
+
+"$DURC" -f "$WORK/script" "$WORK/db" > "$WORK/output"
+expect "$WORK/output"
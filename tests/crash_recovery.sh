@@ -0,0 +1,42 @@
+# inserts acknowledged under --sync-commit survive the process being killed before it checkpoints or closes the
+# database, the log is replayed when the database is opened again
+. "$(dirname "$0")/common.sh"
+
+mkfifo "$WORK/input"
+touch "$WORK/answers"
+stdbuf -oL "$DURC" --sync-commit "$WORK/db" < "$WORK/input" > "$WORK/answers" &
+pid=$!
+exec 3> "$WORK/input"
+
+# ids 1 to 2000 out of order, every insert is answered once its commit is durable
+awk 'BEGIN { for (i = 1; i <= 2000; i++) printf "insert %d user%d user%d@example.com\n", i * 7 % 2000 + 1, i, i }' >&3
+
+waited=0
+
+while [ "$(grep -c executed "$WORK/answers")" -lt 2000 ]; do
+    waited=$((waited + 1))
+    [ $waited -lt 600 ] || { echo "inserts weren't answered"; kill -9 $pid; exit 1; }
+    sleep 0.1
+done
+
+kill -9 $pid
+wait $pid 2> /dev/null || true
+exec 3>&-
+
+printf 'select\ninsert 1000 again again@example.com\ninsert 2001 after after@example.com\n.exit\n' \
+    | "$DURC" "$WORK/db" > "$WORK/output"
+
+# every row in key order, i * 7 % 2000 + 1 = id gives back i
+awk 'BEGIN {
+    printf "db: "
+    for (id = 1; id <= 2000; id++) {
+        i = (id - 1) * 1143 % 2000
+        printf "-- %d user%d user%d@example.com\n", id, i ? i : 2000, i ? i : 2000
+    }
+    print "executed"
+}' > "$WORK/rows"
+
+lines=$(wc -l < "$WORK/rows")
+head -n "$lines" "$WORK/output" | cmp "$WORK/rows" -
+tail -n +$((lines + 1)) "$WORK/output" > "$WORK/tail"
+expect "$WORK/tail"
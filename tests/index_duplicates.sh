@@ -0,0 +1,38 @@
+# a value shared by more rows than an index leaf holds is found in every leaf it spans, and an index answers the same
+# rows as a scan of a table without one
+. "$(dirname "$0")/common.sh"
+
+# ids 1 to 3000 out of order, the even ones named dup and every row with the same email
+rows() {
+    awk -v first="$1" -v last="$2" 'BEGIN {
+        for (i = first; i <= last; i++) {
+            id = i * 7 % 3000 + 1
+            printf "insert %d %s shared@example.com\n", id, id % 2 ? "user" id : "dup"
+        }
+    }'
+}
+
+# the indexes are built over the first half, the second half goes through the inserts keeping them up to date
+{ rows 1 1500; echo ".index create name"; echo ".index create email"; rows 1501 3000; } > "$WORK/indexed"
+rows 1 3000 > "$WORK/scanned"
+
+"$DURC" -f "$WORK/indexed" "$WORK/indexed.db" > /dev/null
+"$DURC" -f "$WORK/scanned" "$WORK/scanned.db" > /dev/null
+
+cat > "$WORK/script" <<'SCRIPT'
+select count where name = dup
+select where name = dup limit 3
+select where name = dup limit 2 offset 1497
+select count where email = shared@example.com
+select where email = shared@example.com limit 2 offset 1500
+select count where name = user1001
+select where name = user1001
+select count where name = user1002
+select count where email = other@example.com
+SCRIPT
+
+"$DURC" -f "$WORK/script" "$WORK/indexed.db" > "$WORK/output"
+"$DURC" -f "$WORK/script" "$WORK/scanned.db" > "$WORK/scan"
+
+cmp "$WORK/output" "$WORK/scan"
+expect "$WORK/output"
@@ -0,0 +1,35 @@
+# selects without a limit split across --scan-threads threads print the same rows in the same order as a serial scan
+. "$(dirname "$0")/common.sh"
+
+# 20000 rows inserted out of order, so the root ends up with many children
+awk 'BEGIN { for (i = 1; i <= 20000; i++) printf "insert %d user%d user%d@example.com\n", i * 7 % 20000 + 1, i, i }' \
+    > "$WORK/load"
+"$DURC" -f "$WORK/load" "$WORK/db" > /dev/null
+
+cat > "$WORK/script" <<'SCRIPT'
+select
+select where id between 3000 and 17000
+select where id between 9999 and 10001
+select count
+SCRIPT
+
+"$DURC" --scan-threads 1 -f "$WORK/script" "$WORK/db" > "$WORK/serial"
+"$DURC" --scan-threads 4 -f "$WORK/script" "$WORK/db" > "$WORK/parallel"
+
+cmp "$WORK/serial" "$WORK/parallel"
+
+# the whole table in key order, then the ids 3000 to 17000
+awk 'BEGIN {
+    for (id = 1; id <= 20000; id++) {
+        i = (id - 1) * 17143 % 20000
+        printf "-- %d user%d user%d@example.com\n", id, i ? i : 20000, i ? i : 20000
+    }
+    print "executed"
+}' > "$WORK/rows"
+awk '$1 == "--" && $2 >= 3000 && $2 <= 17000 { print } END { print "executed" }' "$WORK/rows" > "$WORK/range"
+cat "$WORK/rows" "$WORK/range" > "$WORK/listing"
+
+lines=$(wc -l < "$WORK/listing")
+head -n "$lines" "$WORK/parallel" | cmp "$WORK/listing" -
+tail -n +$((lines + 1)) "$WORK/parallel" > "$WORK/output"
+expect "$WORK/output"